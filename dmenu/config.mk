@@ -11,13 +11,16 @@ MANPREFIX = $(PREFIX)/share/man
 X11INC = /usr/X11R6/include
 X11LIB = /usr/X11R6/lib
 
+# drawing code shared with dwm
+DRAW = ../draw
+
 # Xinerama, comment if you don't want it
 XINERAMALIBS  = -lXinerama
 XINERAMAFLAGS = -DXINERAMA
 
 # includes and libs
-INCS = -I$(X11INC)
-LIBS = -L$(X11LIB) -lX11 $(XINERAMALIBS)
+INCS = -I$(DRAW) -I$(X11INC)
+LIBS = -L$(X11LIB) -lX11 $(XINERAMALIBS) -lpthread
 
 # no -flto with clang
 ifeq ($(CC),clang)
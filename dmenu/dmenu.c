@@ -1,10 +1,15 @@
 /* See LICENSE file for copyright and license details. */
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
@@ -16,31 +21,81 @@
 #define INRECT(x,y,rx,ry,rw,rh) ((x) >= (rx) && (x) < (rx)+(rw) && (y) >= (ry) && (y) < (ry)+(rh))
 #define MIN(a,b)                ((a) < (b) ? (a) : (b))
 #define MAX(a,b)                ((a) > (b) ? (a) : (b))
+#define INDEXMIN                20000    /* items needed to build the trigram index */
+#define MATCHSLICE              20000    /* items matched before the menu is drawn */
+#define NTRIGRAMS               (1 << 16)
+#define THREADMIN               100000   /* items needed to match in parallel */
+#define MAXTHREADS              16
+#define ADDMATCH(tier, i)       ((tier)->n < (tier)->size ? (void)((tier)->idx[(tier)->n++] = (i)) \
+                                 : addmatches((tier), &(i), 1))
+#define TRIGRAM(p)              (((unsigned int)fold[(unsigned char)(p)[0]] << 16 \
+                                 | (unsigned int)fold[(unsigned char)(p)[1]] << 8 \
+                                 | (unsigned int)fold[(unsigned char)(p)[2]]) * 2654435761U >> 16 \
+                                 & (NTRIGRAMS - 1))
 
-typedef struct Item Item;
-struct Item {
-	char *text;
-	Item *left, *right;
-};
+enum { MatchExact, MatchPrefix, MatchSubstr, MatchNone };  /* match types */
 
-static void appenditem(Item *item, Item **list, Item **last);
+typedef struct {
+	unsigned int *idx;  /* into the items */
+	size_t n, size;
+} Tier;  /* matches of one type, in the order of the items */
+
+typedef struct {
+	size_t len;           /* of the input text */
+	unsigned int *match;  /* indices into items, exact matches first */
+	size_t nexact, nprefix, n;
+} Level;  /* match result kept for undoing */
+
+typedef struct {
+	size_t first;  /* of the pending items to match */
+	size_t n;
+	const char *key;
+	size_t len;
+	Tier tiers[MatchNone];
+	pthread_t thread;
+} Worker;  /* one part of a match split among threads */
+
+static void addmatches(Tier *tier, const unsigned int *idx, size_t n);
+static void *buildindex(void *arg);
 static void calcoffsets(void);
-static char *cistrstr(const char *s, const char *sub);
+static void clearlevels(void);
+static size_t copymatches(unsigned int *dst);
 static void drawmenu(void);
 static void grabkeyboard(void);
+static void growitems(void);
+static Bool indexready(void);
 static void insert(const char *str, ssize_t n);
+static int itemw(unsigned int i);
 static void keypress(XKeyEvent *ev);
 static void match(Bool sub);
+static Bool matchindex(const char *key, size_t len, size_t max);
+static unsigned int matchat(size_t pos);
+static void matchitem(unsigned int i, const char *key, size_t len);
+static const char *matchkey(void);
+static void matchparallel(size_t n, const char *key, size_t len);
+static void matchpending(size_t n, size_t want);
+static void matchrest(size_t n);
+static int matchtype(unsigned int i, const char *key, size_t len);
+static void *matchworker(void *arg);
 static size_t nextrune(int inc);
+static size_t pagestart(size_t last);
+static int pagewidth(void);
 static void paste(void);
+static Bool poplevel(size_t len);
+static const char *progress(void);
+static void pushlevel(size_t len);
 static void readstdin(void);
+static void readstream(void);
+static size_t reposition(size_t pos, const size_t *old);
 static void run(void);
 static void setup(void);
+static void splitlines(char *p, char *end);
 static void usage(void);
 
 static char text[BUFSIZ] = "";
 static int bh, mw, mh;
 static int inputw, promptw;
+static int leftw, rightw;  /* textw() of "<" and ">" */
 static int lines = 0;
 static size_t cursor = 0;
 static const char *font = NULL;
@@ -56,18 +111,42 @@ static unsigned long selcol[ColLast];
 static Atom utf8;
 static Bool topbar = True;
 static DC *dc;
-static Item *items = NULL;
-static Item *matches, *matchend;
-static Item *prev, *curr, *next, *sel;
+static char **itemtext = NULL;
+static char **itemkey = NULL;         /* itemtext, lowercase with -i */
+static unsigned int *itemlen = NULL;  /* of itemtext */
+static int *itemwidth = NULL;         /* textw() of itemtext, 0 until needed */
+static size_t nitems = 0, itemsize = 0;
+static char *maxstr = NULL;  /* longest item */
+static size_t maxlen = 0;
+static Tier tiers[MatchNone];  /* the matches are shown tier by tier */
+static size_t nmatches = 0;
+static unsigned int *oldmatches = NULL;  /* what a longer input is matched against */
+static size_t oldsize = 0;
+static size_t pending = 0;  /* next item match() has left for later */
+static size_t npending = 0;
+static Bool pendingsub;     /* pending is in oldmatches */
+static Level *levels = NULL;  /* one per input length while typing at the end */
+static size_t nlevels = 0, levelsize = 0;
+static char leveltext[BUFSIZ];  /* input of the topmost level */
+static unsigned int *postoff = NULL;  /* start of each trigram's items in post */
+static unsigned int *post = NULL;     /* indices of the items containing a trigram */
+static unsigned char fold[256];       /* tolower() */
+static Bool foldcase = False;         /* -i */
+static Bool indexed = False;   /* post is complete, set by buildindex() */
+static Bool indexing = False;  /* buildindex() has been started */
+static pthread_mutex_t indexlock = PTHREAD_MUTEX_INITIALIZER;
+static long nthreads = 1;
+static size_t prev, curr, next, sel;  /* positions in the matches */
 static Window win;
-
-static int (*fstrncmp)(const char *, const char *, size_t) = strncmp;
-static char *(*fstrstr)(const char *, const char *) = strstr;
+static Bool streaming = False;  /* stdin is still read from run() */
+static char *chunk = NULL;     /* stdin buffer, items point into it */
+static size_t chunkstart = 0, chunklen = 0, chunksize = 0;
 
 int
 main(int argc, char *argv[]) {
-	Bool fast = False;
+	Bool fast = False, stream = False;
 	int i;
+	struct stat st;
 
 	for(i = 1; i < argc; i++)
 		/* single flags */
@@ -79,10 +158,10 @@ main(int argc, char *argv[]) {
 			topbar = False;
 		else if(!strcmp(argv[i], "-f"))
 			fast = True;
-		else if(!strcmp(argv[i], "-i")) {
-			fstrncmp = strncasecmp;
-			fstrstr = cistrstr;
-		}
+		else if(!strcmp(argv[i], "-s"))
+			stream = True;
+		else if(!strcmp(argv[i], "-i"))
+			foldcase = True;
 		else if(i+1 == argc)
 			usage();
 		/* double flags */
@@ -109,8 +188,17 @@ main(int argc, char *argv[]) {
 
 	dc = initdc();
 	initfont(dc, font);
+	for(i = 0; i < 256; i++)
+		fold[i] = tolower(i);
+	nthreads = MAX(MIN(sysconf(_SC_NPROCESSORS_ONLN), MAXTHREADS), 1);
 
-	if(fast) {
+	/* files are read at once anyway */
+	if(stream && !fstat(STDIN_FILENO, &st) && !S_ISREG(st.st_mode)) {
+		streaming = True;
+		fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+		grabkeyboard();
+	}
+	else if(fast) {
 		grabkeyboard();
 		readstdin();
 	}
@@ -125,48 +213,87 @@ main(int argc, char *argv[]) {
 }
 
 void
-appenditem(Item *item, Item **list, Item **last) {
-	if(!*last)
-		*list = item;
-	else
-		(*last)->right = item;
+addmatches(Tier *tier, const unsigned int *idx, size_t n) {
+	if(n == 0)
+		return;
+	if(tier->n + n > tier->size) {
+		tier->size = MAX(MAX(2 * tier->size, tier->n + n), 1024);
+		if(!(tier->idx = realloc(tier->idx, tier->size * sizeof *tier->idx)))
+			eprintf("cannot realloc %lu bytes:", tier->size * sizeof *tier->idx);
+	}
+	memcpy(tier->idx + tier->n, idx, n * sizeof *idx);
+	tier->n += n;
+}
 
-	item->left = *last;
-	item->right = NULL;
-	*last = item;
+/* maps each (case folded, hashed) trigram to the items containing it,
+ * in its own thread, as the items do not change once stdin is read */
+void *
+buildindex(void *arg) {
+	unsigned int *fill, h, i;
+	const char *p;
+
+	if(!(postoff = calloc(NTRIGRAMS + 1, sizeof *postoff))
+	|| !(fill = malloc(NTRIGRAMS * sizeof *fill)))
+		eprintf("cannot malloc %lu bytes:", NTRIGRAMS * sizeof *fill);
+	memset(fill, 0xff, NTRIGRAMS * sizeof *fill);
+	for(i = 0; i < nitems; i++)
+		for(p = itemtext[i]; p[0] && p[1] && p[2]; p++) {
+			h = TRIGRAM(p);
+			if(fill[h] != i) {
+				fill[h] = i;
+				postoff[h + 1]++;
+			}
+		}
+	for(h = 0; h < NTRIGRAMS; h++)
+		postoff[h + 1] += postoff[h];
+	if(!(post = malloc(MAX(postoff[NTRIGRAMS], 1) * sizeof *post)))
+		eprintf("cannot malloc %lu bytes:", postoff[NTRIGRAMS] * sizeof *post);
+	memcpy(fill, postoff, NTRIGRAMS * sizeof *fill);
+	for(i = 0; i < nitems; i++)
+		for(p = itemtext[i]; p[0] && p[1] && p[2]; p++) {
+			h = TRIGRAM(p);
+			if(fill[h] == postoff[h] || post[fill[h] - 1] != i)
+				post[fill[h]++] = i;
+		}
+	free(fill);
+	pthread_mutex_lock(&indexlock);
+	indexed = True;
+	pthread_mutex_unlock(&indexlock);
+	return NULL;
 }
 
 void
 calcoffsets(void) {
-	int i, n;
-
-	if(lines > 0)
-		n = lines * bh;
-	else
-		n = mw - (promptw + inputw + textw(dc, "<") + textw(dc, ">"));
+	int i, n = pagewidth();
 
-	for(i = 0, next = curr; next; next = next->right)
-		if((i += (lines > 0) ? bh : MIN(textw(dc, next->text), n)) > n)
-			break;
-	for(i = 0, prev = curr; prev && prev->left; prev = prev->left)
-		if((i += (lines > 0) ? bh : MIN(textw(dc, prev->left->text), n)) > n)
+	for(i = 0, next = curr; next < nmatches; next++)
+		if((i += (lines > 0) ? bh : MIN(itemw(matchat(next)), n)) > n)
 			break;
+	prev = (curr > 0) ? pagestart(curr - 1) : curr;
 }
 
-char *
-cistrstr(const char *s, const char *sub) {
-	size_t len;
+void
+clearlevels(void) {
+	while(nlevels > 0)
+		free(levels[--nlevels].match);
+}
 
-	for(len = strlen(sub); *s; s++)
-		if(!strncasecmp(s, sub, len))
-			return (char *)s;
-	return NULL;
+/* the matches in the order they are shown, returns their number */
+size_t
+copymatches(unsigned int *dst) {
+	size_t n = 0;
+	int t;
+
+	for(t = 0; t < MatchNone; n += tiers[t++].n)
+		if(tiers[t].n > 0)
+			memcpy(dst + n, tiers[t].idx, tiers[t].n * sizeof *dst);
+	return n;
 }
 
 void
 drawmenu(void) {
-	int curpos;
-	Item *item;
+	int curpos, pw = streaming ? textw(dc, progress()) : 0;
+	size_t i;
 
 	dc->x = 0;
 	dc->y = 0;
@@ -178,39 +305,45 @@ drawmenu(void) {
 		drawtext(dc, prompt, selcol, False);
 		dc->x += dc->w;
 	}
-	dc->w = (lines > 0 || !matches) ? mw - dc->x : inputw;
+	dc->w = (lines > 0 || !nmatches) ? mw - dc->x - pw : inputw;
 	drawtext(dc, text, normcol, False);
 	if((curpos = textnw(dc, text, cursor) + dc->h/2 - 2) < dc->w)
 		drawrect(dc, curpos, 2, 1, dc->h - 4, FG(dc, normcol));
 
 	if(lines > 0) {
 		dc->w = mw - dc->x;
-		for(item = curr; item != next; item = item->right) {
+		for(i = curr; i < next; i++) {
 			dc->y += dc->h;
-			if (item == sel)
-				drawtext(dc, item->text, selcol, True);
+			if (i == sel)
+				drawtext(dc, itemtext[matchat(i)], selcol, True);
 			else
-				drawtext(dc, item->text, normcol, False);
+				drawtext(dc, itemtext[matchat(i)], normcol, False);
 		}
 	}
-	else if(matches) {
+	else if(nmatches) {
 		dc->x += inputw;
-		dc->w = textw(dc, "<");
-		if(curr->left)
+		dc->w = leftw;
+		if(curr > 0)
 			drawtext(dc, "<", normcol, False);
-		for(item = curr; item != next; item = item->right) {
+		for(i = curr; i < next; i++) {
 			dc->x += dc->w;
-			dc->w = MIN(textw(dc, item->text), mw - dc->x - textw(dc, ">") - 1);
-			if (item == sel)
-				drawtext(dc, item->text, selcol, True);
+			dc->w = MIN(itemw(matchat(i)), mw - dc->x - rightw - pw - 1);
+			if (i == sel)
+				drawtext(dc, itemtext[matchat(i)], selcol, True);
 			else
-				drawtext(dc, item->text, normcol, False);
+				drawtext(dc, itemtext[matchat(i)], normcol, False);
 		}
-		dc->w = textw(dc, ">");
-		dc->x = mw - dc->w;
-		if(next)
+		dc->w = rightw;
+		dc->x = mw - dc->w - pw;
+		if(next < nmatches)
 			drawtext(dc, ">", normcol, False);
 	}
+	if(streaming) {
+		dc->x = mw - pw;
+		dc->y = 0;
+		dc->w = pw;
+		drawtext(dc, progress(), normcol, False);
+	}
 	mapdc(dc, win, mw, mh);
 }
 
@@ -227,6 +360,37 @@ grabkeyboard(void) {
 	eprintf("cannot grab keyboard\n");
 }
 
+/* the matches are indices, so the items must fit an unsigned int */
+void
+growitems(void) {
+	size_t size = MIN(MAX(2 * itemsize, 1024), (unsigned int)-1);
+
+	if(size == itemsize)
+		eprintf("too many items\n");
+	if(!(itemtext = realloc(itemtext, size * sizeof *itemtext))
+	|| !(itemlen = realloc(itemlen, size * sizeof *itemlen))
+	|| !(itemwidth = realloc(itemwidth, size * sizeof *itemwidth)))
+		eprintf("cannot realloc %lu bytes:", size * sizeof *itemtext);
+	if(!foldcase)
+		itemkey = itemtext;
+	else if(!(itemkey = realloc(itemkey, size * sizeof *itemkey)))
+		eprintf("cannot realloc %lu bytes:", size * sizeof *itemkey);
+	itemsize = size;
+}
+
+/* whether buildindex() has finished */
+Bool
+indexready(void) {
+	static Bool ready = False;
+
+	if(!ready) {
+		pthread_mutex_lock(&indexlock);
+		ready = indexed;
+		pthread_mutex_unlock(&indexlock);
+	}
+	return ready;
+}
+
 void
 insert(const char *str, ssize_t n) {
 	if(strlen(text) + n > sizeof text - 1)
@@ -238,6 +402,14 @@ insert(const char *str, ssize_t n) {
 	match(n > 0 && text[cursor] == '\0');
 }
 
+/* items are measured once, when first shown */
+int
+itemw(unsigned int i) {
+	if(!itemwidth[i])
+		itemwidth[i] = textw(dc, itemtext[i]);
+	return itemwidth[i];
+}
+
 void
 keypress(XKeyEvent *ev) {
 	char buf[32];
@@ -302,53 +474,52 @@ keypress(XKeyEvent *ev) {
 			cursor = strlen(text);
 			break;
 		}
-		if(next) {
-			curr = matchend;
-			calcoffsets();
-			curr = prev;
+		matchrest(npending);
+		if(next < nmatches) {
+			curr = pagestart(nmatches - 1);
 			calcoffsets();
-			while(next && (curr = curr->right))
-				calcoffsets();
 		}
-		sel = matchend;
+		sel = MAX(nmatches, 1) - 1;
 		break;
 	case XK_Escape:
 		exit(EXIT_FAILURE);
 	case XK_Home:
-		if(sel == matches) {
+		if(sel == 0) {
 			cursor = 0;
 			break;
 		}
-		sel = curr = matches;
+		sel = curr = 0;
 		calcoffsets();
 		break;
 	case XK_Left:
-		if(cursor > 0 && (!sel || !sel->left || lines > 0)) {
+		if(cursor > 0 && (sel == 0 || lines > 0)) {
 			cursor = nextrune(-1);
 			break;
 		}
 		/* fallthrough */
 	case XK_Up:
-		if(sel && sel->left && (sel = sel->left)->right == curr) {
+		if(sel > 0 && sel-- == curr) {
 			curr = prev;
 			calcoffsets();
 		}
 		break;
 	case XK_Next:
-		if(!next)
+		matchrest(npending);
+		if(next == nmatches)
 			return;
 		sel = curr = next;
 		calcoffsets();
 		break;
 	case XK_Prior:
-		if(!prev)
+		if(!nmatches)
 			return;
 		sel = curr = prev;
 		calcoffsets();
 		break;
 	case XK_Return:
 	case XK_KP_Enter:
-		puts((sel && !(ev->state & ShiftMask)) ? sel->text : text);
+		matchrest(npending);
+		puts((nmatches && !(ev->state & ShiftMask)) ? itemtext[matchat(sel)] : text);
 		exit(EXIT_SUCCESS);
 	case XK_Right:
 		if(text[cursor] != '\0') {
@@ -357,15 +528,17 @@ keypress(XKeyEvent *ev) {
 		}
 		/* fallthrough */
 	case XK_Down:
-		if(sel && sel->right && (sel = sel->right) == next) {
+		matchrest(npending);
+		if(sel + 1 < nmatches && ++sel == next) {
 			curr = next;
 			calcoffsets();
 		}
 		break;
 	case XK_Tab:
-		if(!sel)
+		matchrest(npending);
+		if(!nmatches)
 			return;
-		strncpy(text, sel->text, sizeof text - 1);
+		strncpy(text, itemtext[matchat(sel)], sizeof text - 1);
 		cursor = strlen(text);
 		match(True);
 		break;
@@ -376,44 +549,182 @@ keypress(XKeyEvent *ev) {
 void
 match(Bool sub) {
 	size_t len = strlen(text);
-	Item *lexact, *lprefix, *lsubstr, *exactend, *prefixend, *substrend;
-	Item *item, *lnext;
-
-	lexact = lprefix = lsubstr = exactend = prefixend = substrend = NULL;
-	for(item = sub ? matches : items; item && item->text; item = lnext) {
-		lnext = sub ? item->right : item + 1;
-		if(!fstrncmp(text, item->text, len + 1))
-			appenditem(item, &lexact, &exactend);
-		else if(!fstrncmp(text, item->text, len))
-			appenditem(item, &lprefix, &prefixend);
-		else if(fstrstr(item->text, text))
-			appenditem(item, &lsubstr, &substrend);
-	}
-	matches = lexact;
-	matchend = exactend;
-
-	if(lprefix) {
-		if(matchend) {
-			matchend->right = lprefix;
-			lprefix->left = matchend;
+	int t;
+
+	if(npending > 0) { /* the old matches are incomplete */
+		sub = False;
+		npending = 0;
+	}
+	if(sub || !poplevel(len)) {
+		if(sub) {
+			if(nmatches > oldsize
+			&& !(oldmatches = realloc(oldmatches, (oldsize = nmatches) * sizeof *oldmatches)))
+				eprintf("cannot realloc %lu bytes:", nmatches * sizeof *oldmatches);
+			npending = copymatches(oldmatches);
 		}
 		else
-			matches = lprefix;
-		matchend = prefixend;
+			npending = nitems;
+		for(t = 0; t < MatchNone; t++)
+			tiers[t].n = 0;
+		nmatches = 0;
+		if(len >= 3 && indexready() && matchindex(matchkey(), len, npending))
+			npending = 0;
+		pending = 0;
+		pendingsub = sub;
+		/* enough for the first page, the rest is matched from run() */
+		if(streaming || npending <= MATCHSLICE)
+			matchpending(npending, (size_t)-1);
+		else
+			matchpending(MATCHSLICE, 2 * (lines > 0 ? lines : mw / MAX(dc->font.height, 1)));
+	}
+	curr = sel = 0;
+	calcoffsets();
+}
+
+/* every match contains all trigrams of text, so only the items of its
+ * rarest trigram are matched, if they are fewer than max, in the same order
+ * as all items would be; a longer input's matches are among them as well */
+Bool
+matchindex(const char *key, size_t len, size_t max) {
+	unsigned int h, best, i;
+	const char *p;
+
+	for(best = TRIGRAM(text), p = text + 1; p[2]; p++) {
+		h = TRIGRAM(p);
+		if(postoff[h + 1] - postoff[h] < postoff[best + 1] - postoff[best])
+			best = h;
+	}
+	if(postoff[best + 1] - postoff[best] >= max)
+		return False;
+	for(i = postoff[best]; i < postoff[best + 1]; i++)
+		matchitem(post[i], key, len);
+	return True;
+}
+
+/* the item shown at position pos of the matches */
+unsigned int
+matchat(size_t pos) {
+	int t;
+
+	for(t = 0; pos >= tiers[t].n; pos -= tiers[t++].n);
+	return tiers[t].idx[pos];
+}
+
+void
+matchitem(unsigned int i, const char *key, size_t len) {
+	int t;
+
+	if((t = matchtype(i, key, len)) == MatchNone)
+		return;
+	ADDMATCH(&tiers[t], i);
+	nmatches++;
+}
+
+/* the input as the items' keys are compared to it */
+const char *
+matchkey(void) {
+	static char buf[sizeof text];
+	size_t i;
+
+	if(!foldcase)
+		return text;
+	for(i = 0; (buf[i] = fold[(unsigned char)text[i]]); i++);
+	return buf;
+}
+
+/* each thread matches a part of the pending items into its own tiers, which
+ * are then joined part by part, so the order is that of matchitem() */
+void
+matchparallel(size_t n, const char *key, size_t len) {
+	Worker w[MAXTHREADS];
+	size_t i;
+	int t;
+
+	memset(w, 0, sizeof w);
+	for(i = 0; i < (size_t)nthreads; i++) {
+		w[i].first = (i > 0) ? w[i-1].first + w[i-1].n : pending;
+		w[i].n = n / nthreads + (i < n % nthreads);
+		w[i].key = key;
+		w[i].len = len;
 	}
-	if(lsubstr) {
-		if(matchend) {
-			matchend->right = lsubstr;
-			lsubstr->left = matchend;
+	for(i = 1; i < (size_t)nthreads; i++)
+		if(pthread_create(&w[i].thread, NULL, matchworker, &w[i]))
+			eprintf("cannot create thread\n");
+	matchworker(&w[0]);
+	for(i = 1; i < (size_t)nthreads; i++)
+		pthread_join(w[i].thread, NULL);
+
+	for(t = 0; t < MatchNone; t++)
+		for(i = 0; i < (size_t)nthreads; i++) {
+			addmatches(&tiers[t], w[i].tiers[t].idx, w[i].tiers[t].n);
+			nmatches += w[i].tiers[t].n;
+			free(w[i].tiers[t].idx);
 		}
-		else
-			matches = lsubstr;
-		matchend = substrend;
+}
+
+/* matches the next n pending items, or fewer once there are want matches */
+void
+matchpending(size_t n, size_t want) {
+	size_t len = strlen(text);
+	const char *key = matchkey();
+
+	if((n = MIN(n, npending)) >= THREADMIN && nthreads > 1) {
+		matchparallel(n, key, len);
+		pending += n;
+		npending -= n;
+	}
+	else
+		for(; n > 0 && nmatches < want; n--, npending--, pending++)
+			matchitem(pendingsub ? oldmatches[pending] : pending, key, len);
+	if(npending == 0)
+		pushlevel(len);
+}
+
+/* unless the user has moved on, better matches found later come first */
+void
+matchrest(size_t n) {
+	size_t old[MatchNone];
+	int t;
+
+	if(npending == 0)
+		return;
+	for(t = 0; t < MatchNone; t++)
+		old[t] = tiers[t].n;
+	matchpending(n, (size_t)-1);
+	if(sel > 0) {
+		sel = reposition(sel, old);
+		curr = reposition(curr, old);
 	}
-	curr = sel = matches;
 	calcoffsets();
 }
 
+/* the lengths rule out most items before their text is read */
+int
+matchtype(unsigned int i, const char *key, size_t len) {
+	if(itemlen[i] < len)
+		return MatchNone;
+	else if(!memcmp(key, itemkey[i], len))
+		return (itemlen[i] == len) ? MatchExact : MatchPrefix;
+	else if(strstr(itemkey[i] + 1, key))
+		return MatchSubstr;
+	return MatchNone;
+}
+
+void *
+matchworker(void *arg) {
+	Worker *w = arg;
+	size_t i, end = w->first + w->n;
+	unsigned int item;
+	int t;
+
+	for(i = w->first; i < end; i++) {
+		item = pendingsub ? oldmatches[i] : i;
+		if((t = matchtype(item, w->key, w->len)) != MatchNone)
+			ADDMATCH(&w->tiers[t], item);
+	}
+	return NULL;
+}
+
 size_t
 nextrune(int inc) {
 	ssize_t n;
@@ -422,6 +733,26 @@ nextrune(int inc) {
 	return n;
 }
 
+/* the first position of the page that ends with last */
+size_t
+pagestart(size_t last) {
+	size_t pos;
+	int i, n = pagewidth();
+
+	for(i = 0, pos = last + 1; pos > 0; pos--)
+		if((i += (lines > 0) ? bh : MIN(itemw(matchat(pos - 1)), n)) > n)
+			break;
+	return pos;
+}
+
+int
+pagewidth(void) {
+	if(lines > 0)
+		return lines * bh;
+	return mw - (promptw + inputw + leftw + rightw
+	             + (streaming ? textw(dc, progress()) : 0));
+}
+
 void
 paste(void) {
 	char *p, *q;
@@ -436,32 +767,201 @@ paste(void) {
 	drawmenu();
 }
 
+/* restores the matches of an earlier, shorter input, if it is a prefix of
+ * the current one, instead of matching all items again */
+Bool
+poplevel(size_t len) {
+	Level *l;
+	size_t n[MatchNone], i;
+	int t;
+
+	if(strncmp(text, leveltext, len))
+		return False;
+	for(; nlevels > 0 && levels[nlevels-1].len > len; free(levels[--nlevels].match));
+	leveltext[len] = '\0';
+	if(nlevels == 0 || (l = &levels[nlevels-1])->len != len)
+		return False;
+	n[MatchExact] = l->nexact;
+	n[MatchPrefix] = l->nprefix;
+	n[MatchSubstr] = l->n - l->nexact - l->nprefix;
+	for(i = 0, t = 0; t < MatchNone; i += n[t++]) {
+		tiers[t].n = 0;
+		addmatches(&tiers[t], l->match + i, n[t]);
+	}
+	nmatches = l->n;
+	return True;
+}
+
+/* count shown while stdin is streamed */
+const char *
+progress(void) {
+	static char buf[64];
+
+	sprintf(buf, "%lu/%lu", (unsigned long)nmatches, (unsigned long)nitems);
+	return buf;
+}
+
+/* remembers the current matches, the levels below must be for prefixes */
+void
+pushlevel(size_t len) {
+	Level *l;
+
+	if(strncmp(text, leveltext, strlen(leveltext)))
+		clearlevels();
+	for(; nlevels > 0 && levels[nlevels-1].len >= len; free(levels[--nlevels].match));
+	if(nlevels == levelsize
+	&& !(levels = realloc(levels, (levelsize = MAX(2 * levelsize, 16)) * sizeof *levels)))
+		eprintf("cannot realloc %lu bytes:", levelsize * sizeof *levels);
+	l = &levels[nlevels++];
+	l->len = len;
+	l->n = nmatches;
+	l->nexact = tiers[MatchExact].n;
+	l->nprefix = tiers[MatchPrefix].n;
+	if(!(l->match = malloc(MAX(nmatches, 1) * sizeof *l->match)))
+		eprintf("cannot malloc %lu bytes:", nmatches * sizeof *l->match);
+	copymatches(l->match);
+	strcpy(leveltext, text);
+}
+
+/* reads all of stdin into one buffer, mapped if stdin is a file */
 void
 readstdin(void) {
-	char buf[sizeof text], *p, *maxstr = NULL;
-	size_t i, max = 0, size = 0;
-
-	for(i = 0; fgets(buf, sizeof buf, stdin); i++) {
-		if(i+1 >= size / sizeof *items)
-			if(!(items = realloc(items, (size += BUFSIZ))))
-				eprintf("cannot realloc %lu bytes:", size);
-		if((p = strchr(buf, '\n')))
-			*p = '\0';
-		if(!(items[i].text = strdup(buf)))
-			eprintf("cannot strdup %lu bytes:", strlen(buf)+1);
-		if(strlen(items[i].text) > max)
-			max = strlen(maxstr = items[i].text);
-	}
-	if(items)
-		items[i].text = NULL;
+	char *buf = NULL, *p;
+	size_t len = 0, size = 0;
+	ssize_t n;
+	off_t off;
+	struct stat st;
+
+	if(!fstat(STDIN_FILENO, &st) && S_ISREG(st.st_mode)
+	&& (off = lseek(STDIN_FILENO, 0, SEEK_CUR)) >= 0 && st.st_size > off
+	&& (buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	               STDIN_FILENO, 0)) != MAP_FAILED) {
+		for(p = buf + st.st_size; p > buf + off && p[-1] != '\n'; p--);
+		splitlines(buf + off, p);
+		/* the last line has no room for its terminator */
+		if((len = buf + st.st_size - p) > 0) {
+			if(!(buf = malloc(len + 1)))
+				eprintf("cannot malloc %lu bytes:", len + 1);
+			memcpy(buf, p, len);
+			buf[len++] = '\n';
+			splitlines(buf, buf + len);
+		}
+	}
+	else {
+		for(buf = NULL;;) {
+			if(len == size && !(buf = realloc(buf, (size = MAX(2 * size, BUFSIZ)) + 1)))
+				eprintf("cannot realloc %lu bytes:", size + 1);
+			if((n = read(STDIN_FILENO, buf + len, size - len)) > 0)
+				len += n;
+			else if(n == 0 || errno != EINTR)
+				break;
+		}
+		if(len > 0 && buf[len - 1] != '\n')
+			buf[len++] = '\n';
+		splitlines(buf, buf + len);
+	}
 	inputw = maxstr ? textw(dc, maxstr) : 0;
 }
 
+/* reads what stdin has without blocking and matches the new lines */
+void
+readstream(void) {
+	const char *key;
+	char *p, *buf;
+	size_t len, first = nitems, old[MatchNone];
+	ssize_t n;
+	int t;
+
+	if(chunklen == chunksize) {
+		/* the partial line moves to a new chunk, the old one stays for its
+		 * items, if it has any */
+		chunksize = MAX(2 * (chunklen - chunkstart), BUFSIZ * 16);
+		if(!(buf = malloc(chunksize + 1)))
+			eprintf("cannot malloc %lu bytes:", chunksize + 1);
+		if(chunk)
+			memcpy(buf, chunk + chunkstart, chunklen - chunkstart);
+		if(chunkstart == 0)
+			free(chunk);
+		chunklen -= chunkstart;
+		chunkstart = 0;
+		chunk = buf;
+	}
+	if((n = read(STDIN_FILENO, chunk + chunklen, chunksize - chunklen)) < 0) {
+		if(errno == EAGAIN || errno == EINTR)
+			return;
+		n = 0;
+	}
+	chunklen += n;
+	if(n == 0) {
+		streaming = False;
+		if(chunklen > chunkstart && chunk[chunklen - 1] != '\n')
+			chunk[chunklen++] = '\n';
+	}
+	for(p = chunk + chunklen; p > chunk + chunkstart && p[-1] != '\n'; p--);
+	if(p > chunk + chunkstart) {
+		splitlines(chunk + chunkstart, p);
+		chunkstart = p - chunk;
+	}
+	for(t = 0; t < MatchNone; t++)
+		old[t] = tiers[t].n;
+	for(key = matchkey(), len = strlen(text); first < nitems; first++)
+		matchitem(first, key, len);
+	clearlevels(); /* they lack the new items */
+	if(maxstr)
+		inputw = MIN(textw(dc, maxstr), mw/3);
+	/* unless the user has moved on, new better matches come first */
+	if(sel > 0) {
+		sel = reposition(sel, old);
+		curr = reposition(curr, old);
+	}
+	calcoffsets();
+	drawmenu();
+}
+
+/* where the match at pos has moved to, now that the tiers have grown from
+ * old[] matches each */
+size_t
+reposition(size_t pos, const size_t *old) {
+	size_t newpos = 0;
+	int t;
+
+	for(t = 0; pos >= old[t]; pos -= old[t], newpos += tiers[t++].n);
+	return newpos + pos;
+}
+
 void
 run(void) {
 	XEvent ev;
+	struct pollfd pfd[2];
+	pthread_t indexer;
 
-	while(!XNextEvent(dc->dpy, &ev))
+	pfd[0].fd = ConnectionNumber(dc->dpy);
+	pfd[1].fd = STDIN_FILENO;
+	pfd[0].events = pfd[1].events = POLLIN;
+	for(;;) {
+		/* once the menu is shown, not to delay it */
+		if(npending > 0 && !XPending(dc->dpy)) {
+			matchrest(nthreads > 1 ? npending : MATCHSLICE);
+			if(npending == 0)
+				drawmenu();
+			continue;
+		}
+		/* once stdin is read, built aside not to delay the keys */
+		if(!indexing && !streaming) {
+			indexing = True;
+			if(nitems >= INDEXMIN
+			&& !pthread_create(&indexer, NULL, buildindex, NULL))
+				pthread_detach(indexer);
+		}
+		if(streaming && !XPending(dc->dpy)) {
+			if(poll(pfd, 2, -1) < 0 && errno != EINTR)
+				eprintf("poll:");
+			if(pfd[1].revents)
+				readstream();
+			continue;
+		}
+		if(XNextEvent(dc->dpy, &ev))
+			break;
 		switch(ev.type) {
 		case Expose:
 			if(ev.xexpose.count == 0)
@@ -479,6 +979,7 @@ run(void) {
 				XRaiseWindow(dc->dpy, win);
 			break;
 		}
+	}
 }
 
 void
@@ -527,6 +1028,8 @@ setup(void) {
 		mw = DisplayWidth(dc->dpy, screen);
 	}
 	promptw = prompt ? textw(dc, prompt) : 0;
+	leftw = textw(dc, "<");
+	rightw = textw(dc, ">");
 	inputw = MIN(inputw, mw/3);
 	match(False);
 
@@ -544,9 +1047,38 @@ setup(void) {
 	drawmenu();
 }
 
+/* turns the lines in [p, end) into items in place, end[-1] must be '\n' */
+void
+splitlines(char *p, char *end) {
+	char *q, *folded, *start = p;
+	size_t i, first = nitems;
+
+	for(; p < end; p = q + 1) {
+		q = memchr(p, '\n', end - p);
+		*q = '\0';
+		if(nitems == itemsize)
+			growitems();
+		itemtext[nitems] = p;
+		itemlen[nitems] = q - p;
+		itemwidth[nitems] = 0;
+		nitems++;
+		if((size_t)(q - p) > maxlen)
+			maxlen = q - (maxstr = p);
+	}
+	/* so that -i matches with the plain, faster string functions */
+	if(foldcase && nitems > first) {
+		if(!(folded = malloc(end - start)))
+			eprintf("cannot malloc %lu bytes:", end - start);
+		for(i = 0; i < (size_t)(end - start); i++)
+			folded[i] = fold[(unsigned char)start[i]];
+		for(; first < nitems; first++)
+			itemkey[first] = folded + (itemtext[first] - start);
+	}
+}
+
 void
 usage(void) {
-	fputs("usage: dmenu [-b] [-f] [-i] [-l lines] [-p prompt] [-fn font]\n"
+	fputs("usage: dmenu [-b] [-f] [-i] [-s] [-l lines] [-p prompt] [-fn font]\n"
 	      "             [-nb color] [-nf color] [-sb color] [-sf color] [-v]\n", stderr);
 	exit(EXIT_FAILURE);
 }
@@ -13,26 +13,37 @@
 
 static Bool loadfont(DC *dc, const char *fontstr);
 
+/* points and rectangles of one color are sent together by flushdc() */
+void
+drawpoint(DC *dc, int x, int y, unsigned long color) {
+	if(dc->nbatch == BATCHSIZE || !dc->batchispoints || color != dc->batchcolor)
+		flushdc(dc);
+	dc->batchispoints = True;
+	dc->batchcolor = color;
+	dc->points[dc->nbatch].x = dc->x + x;
+	dc->points[dc->nbatch++].y = dc->y + y;
+}
+
 void
 drawrect(DC *dc, int x, int y, unsigned int w, unsigned int h, unsigned long color) {
-	XSetForeground(dc->dpy, dc->gc, color);
-	XFillRectangle(dc->dpy, dc->canvas, dc->gc, dc->x + x, dc->y + y, w, h);
+	if(dc->nbatch == BATCHSIZE || dc->batchispoints || color != dc->batchcolor)
+		flushdc(dc);
+	dc->batchispoints = False;
+	dc->batchcolor = color;
+	dc->rects[dc->nbatch].x = dc->x + x;
+	dc->rects[dc->nbatch].y = dc->y + y;
+	dc->rects[dc->nbatch].width = w;
+	dc->rects[dc->nbatch++].height = h;
 }
 
 void
 drawrectrounded(DC *dc, int x, int y, unsigned int w, unsigned int h, unsigned long color, unsigned long edgecolor) {
-	int x1, y1, x2, y2;
 	drawrect(dc, x, y, w, h, color);
 	if(edgecolor != color) {
-		x1 = dc->x + x;
-		y1 = dc->y + y;
-		x2 = x1 + w-1;
-		y2 = y1 + h-1;
-		XSetForeground(dc->dpy, dc->gc, edgecolor);
-		XDrawPoint(dc->dpy, dc->canvas, dc->gc, x1, y1);
-		XDrawPoint(dc->dpy, dc->canvas, dc->gc, x1, y2);
-		XDrawPoint(dc->dpy, dc->canvas, dc->gc, x2, y1);
-		XDrawPoint(dc->dpy, dc->canvas, dc->gc, x2, y2);
+		drawpoint(dc, x, y, edgecolor);
+		drawpoint(dc, x, y + h-1, edgecolor);
+		drawpoint(dc, x + w-1, y, edgecolor);
+		drawpoint(dc, x + w-1, y + h-1, edgecolor);
 	}
 }
 
@@ -40,14 +51,19 @@ void
 drawtext(DC *dc, const char *text, unsigned long col[ColLast], Bool rounded) {
 	char buf[BUFSIZ];
 	size_t mn, n = strlen(text);
+	int w = dc->w - dc->font.height/2;
 
 	/* shorten text if necessary */
-	for(mn = MIN(n, sizeof buf); textnw(dc, text, mn) + dc->font.height/2 > dc->w; mn--)
-		if(mn == 0)
+	if(n > sizeof buf - 4 || textnw(dc, text, n) > w) {
+		if((w -= textnw(dc, "...", 3)) < 0)
 			return;
-	memcpy(buf, text, mn);
-	if(mn < n)
-		for(n = MAX(mn-3, 0); n < mn; buf[n++] = '.');
+		mn = textfit(dc, text, MIN(n, sizeof buf - 4), w);
+		memcpy(buf, text, mn);
+		memcpy(buf + mn, "...", 3);
+		mn += 3;
+	}
+	else
+		memcpy(buf, text, mn = n);
 
 	if(rounded)
 		drawrectrounded(dc, 0, 0, dc->w, dc->h, BG(dc, col), col[ColEdge]);
@@ -61,13 +77,12 @@ drawtextn(DC *dc, const char *text, size_t n, unsigned long col[ColLast]) {
 	int x = dc->x + dc->font.height/2;
 	int y = dc->y + dc->font.ascent+1;
 
-	XSetForeground(dc->dpy, dc->gc, FG(dc, col));
+	flushdc(dc);
+	setforeground(dc, FG(dc, col));
 	if(dc->font.set)
 		Xutf8DrawString(dc->dpy, dc->canvas, dc->font.set, dc->gc, x, y, text, n);
-	else {
-		XSetFont(dc->dpy, dc->gc, dc->font.xfont->fid);
+	else
 		XDrawString(dc->dpy, dc->canvas, dc->gc, x, y, text, n);
-	}
 }
 
 void
@@ -85,6 +100,19 @@ eprintf(const char *fmt, ...) {
 	exit(EXIT_FAILURE);
 }
 
+/* sends the pending points or rectangles to the canvas */
+void
+flushdc(DC *dc) {
+	if(!dc->nbatch)
+		return;
+	setforeground(dc, dc->batchcolor);
+	if(dc->batchispoints)
+		XDrawPoints(dc->dpy, dc->canvas, dc->gc, dc->points, dc->nbatch, CoordModeOrigin);
+	else
+		XFillRectangles(dc->dpy, dc->canvas, dc->gc, dc->rects, dc->nbatch);
+	dc->nbatch = 0;
+}
+
 void
 freedc(DC *dc) {
 	if(dc->font.set)
@@ -133,11 +161,12 @@ initfont(DC *dc, const char *fontstr) {
 			eprintf("cannot load font '%s'\n", DEFAULTFN);
 	}
 	dc->font.height = dc->font.ascent + dc->font.descent;
+	memset(dc->widths, 0, sizeof dc->widths);
 }
 
 Bool
 loadfont(DC *dc, const char *fontstr) {
-	char *def, **missing, **names;
+	char c, *def, **missing, **names;
 	int i, n;
 	XFontStruct **xfonts;
 
@@ -155,6 +184,11 @@ loadfont(DC *dc, const char *fontstr) {
 		dc->font.ascent  = dc->font.xfont->ascent;
 		dc->font.descent = dc->font.xfont->descent;
 		dc->font.width   = dc->font.xfont->max_bounds.width;
+		XSetFont(dc->dpy, dc->gc, dc->font.xfont->fid);
+		for(i = 0; i < 256; i++) {
+			c = i;
+			dc->font.advance[i] = XTextWidth(dc->font.xfont, &c, 1);
+		}
 	}
 	if(missing)
 		XFreeStringList(missing);
@@ -163,11 +197,13 @@ loadfont(DC *dc, const char *fontstr) {
 
 void
 mapdc(DC *dc, Window win, unsigned int w, unsigned int h) {
+	flushdc(dc);
 	XCopyArea(dc->dpy, dc->canvas, win, dc->gc, 0, 0, w, h, 0, 0);
 }
 
 void
 resizedc(DC *dc, unsigned int w, unsigned int h) {
+	dc->nbatch = 0;
 	if(dc->canvas)
 		XFreePixmap(dc->dpy, dc->canvas);
 
@@ -177,15 +213,61 @@ resizedc(DC *dc, unsigned int w, unsigned int h) {
 	                           DefaultDepth(dc->dpy, DefaultScreen(dc->dpy)));
 }
 
+/* skips the request if the GC already has this color */
+void
+setforeground(DC *dc, unsigned long color) {
+	if(dc->fgvalid && dc->fg == color)
+		return;
+	XSetForeground(dc->dpy, dc->gc, color);
+	dc->fg = color;
+	dc->fgvalid = True;
+}
+
+/* longest prefix of text that is at most w wide, found by binary search
+ * and never cutting a UTF-8 character */
+size_t
+textfit(DC *dc, const char *text, size_t n, int w) {
+	size_t lo = 0, hi = n, m, cut;
+
+	while(lo < hi) {
+		for(m = cut = hi - (hi - lo) / 2; cut > lo && (text[cut] & 0xc0) == 0x80; cut--);
+		if(cut > lo && textnw(dc, text, cut) <= w)
+			lo = cut;
+		else
+			hi = m - 1;
+	}
+	return lo;
+}
+
+/* a core font is measured by its advance table, a fontset converts the text
+ * each time, so the widths of short texts are kept */
 int
 textnw(DC *dc, const char *text, size_t len) {
-	if(dc->font.set) {
-		XRectangle r;
+	Width *cw;
+	XRectangle r;
+	unsigned int h = len;
+	size_t i;
+	int w;
 
+	if(!dc->font.set) {
+		for(w = 0; len--; text++)
+			w += dc->font.advance[(unsigned char)*text];
+		return w;
+	}
+	if(len > WIDTHLEN) {
 		Xutf8TextExtents(dc->font.set, text, len, NULL, &r);
 		return r.width;
 	}
-	return XTextWidth(dc->font.xfont, text, len);
+	for(i = 0; i < len; i++)
+		h = h * 31 + (unsigned char)text[i];
+	cw = &dc->widths[h % NWIDTHS];
+	if(cw->len != len || memcmp(cw->text, text, len) || !cw->w) {
+		Xutf8TextExtents(dc->font.set, text, len, NULL, &r);
+		memcpy(cw->text, text, len);
+		cw->len = len;
+		cw->w = r.width;
+	}
+	return cw->w;
 }
 
 int
@@ -3,34 +3,57 @@
 #define FG(dc, col)  ((col)[(dc)->invert ? ColBG : ColFG])
 #define BG(dc, col)  ((col)[(dc)->invert ? ColFG : ColBG])
 
-enum { ColBG, ColFG, ColEdge, ColLast };
+#define BATCHSIZE    64  /* rectangles or points sent in one request */
+#define NWIDTHS      256 /* text widths kept by textnw() */
+#define WIDTHLEN     64  /* longest text whose width is kept */
+
+enum { ColBorder, ColFG, ColBG, ColEdge, ColLast };
+
+typedef struct {
+	char text[WIDTHLEN];
+	size_t len;
+	int w;
+} Width;  /* cached width of a fontset text */
 
 typedef struct {
 	int x, y, w, h;
 	Bool invert;
 	Display *dpy;
 	GC gc;
+	unsigned long fg;  /* foreground of gc as last set */
+	Bool fgvalid;
 	Pixmap canvas;
+	XRectangle rects[BATCHSIZE];  /* pending rectangles or points of batchcolor */
+	XPoint points[BATCHSIZE];
+	unsigned int nbatch;
+	Bool batchispoints;
+	unsigned long batchcolor;
+	Width widths[NWIDTHS];
 	struct {
 		int ascent;
 		int descent;
 		int height;
 		int width;
+		int advance[256];  /* per character of a core font */
 		XFontSet set;
 		XFontStruct *xfont;
 	} font;
 } DC;  /* draw context */
 
+void drawpoint(DC *dc, int x, int y, unsigned long color);
 void drawrect(DC *dc, int x, int y, unsigned int w, unsigned int h, unsigned long color);
 void drawrectrounded(DC *dc, int x, int y, unsigned int w, unsigned int h, unsigned long color, unsigned long edgecolor);
 void drawtext(DC *dc, const char *text, unsigned long col[ColLast], Bool rounded);
 void drawtextn(DC *dc, const char *text, size_t n, unsigned long col[ColLast]);
 void eprintf(const char *fmt, ...);
+void flushdc(DC *dc);
 void freedc(DC *dc);
 unsigned long getcolor(DC *dc, const char *colstr);
 DC *initdc(void);
 void initfont(DC *dc, const char *fontstr);
 void mapdc(DC *dc, Window win, unsigned int w, unsigned int h);
 void resizedc(DC *dc, unsigned int w, unsigned int h);
+void setforeground(DC *dc, unsigned long color);
+size_t textfit(DC *dc, const char *text, size_t n, int w);
 int textnw(DC *dc, const char *text, size_t len);
 int textw(DC *dc, const char *text);
@@ -38,7 +38,9 @@ Rule rules[] = {
 #define MAXWSTEXTWIDTH		   6	/* must be 2*(strlen(MAXWORKSPACES)+1)  */
 #define MAXXINERAMASCREENS	   4
 #define HORIZONTALAUTOSPLIT	1700	/* split screen into multiple workspaces when wider than this */
-#define REFRESH_HZ		  60	/* refresh frequency for movemouse() and resizemouse() */
+#define REFRESH_HZ		  60	/* refresh frequency for movemouse() and resizemouse() if RandR knows no better */
+#define MAXREFRESH_HZ		 144	/* upper limit for RandR refresh frequencies, 0 = no limit */
+#define SYNCTIMEOUT		 100	/* ms to wait for a _NET_WM_SYNC_REQUEST client to repaint in resizemouse() */
 
 /* show stack size in status bar - undefine SHOWSTACKSIZE to disable */
 #define SHOWSTACKSIZE
@@ -46,10 +48,23 @@ Rule rules[] = {
 /* rotate layouts on swapscreen() - undefine SWAPSCREEN_LAYOUT to disable */
 #define SWAPSCREEN_LAYOUT
 
+/* resize clients on the neighbouring workspaces while idle, so viewrel() only needs to move them - undefine to disable */
+#define PREARRANGE
+
+/* draw the bar into shared memory client-side (MIT-SHM) instead of sending drawing requests - undefine SHMBAR to disable */
+#define SHMBAR
+
 /* snap clients to local screen borders on mousemove() - undefine to snap to global borders */
 /* only relevant with multiple screens */
 #define SNAPLOCALBORDERS
 
+/* snap clients to the edges of other visible clients on mousemove() - undefine to snap to screen borders only */
+#define SNAPCLIENTS
+
+/* placement of new floating clients: PlaceBestFit (smallest free area they fit in),
+ * PlaceLargest (centered in the largest free area) or PlaceOff (where they ask to be) */
+#define PLACEMENT		PlaceBestFit
+
 /* when a floting client is within this pixel distance of screen or workplace edges,               */
 /* its border is set to BORDERPX instead of FLOATBORDERPX                                          */
 /* with eg. BORDERPX=0 and FLOATBORDERPX=2 only floting, non-fullscreen clients will have a border */
@@ -61,6 +76,17 @@ Rule rules[] = {
  * set to 0 to deactivate */
 #define STATUSBARTIMEOUT	60
 
+/* number of status segments, set via the DWM_MITCH_STATUS0, DWM_MITCH_STATUS1, ... properties
+ * of the X root window or the "segment" IPC command; they replace the plain status text and
+ * time out separately */
+#define STATUSSEGMENTS		8
+
+/* built-in status text (time and load average), used until the X root window name is set,
+ * eg. by ~/.dwm-status - undefine BUILTINSTATUS to disable */
+#define BUILTINSTATUS
+#define BUILTINSTATUSTIME	"%H:%M:%S"	/* strftime() format */
+#define BUILTINSTATUSINTERVAL	2		/* update interval in seconds */
+
 /* ugly: depending on constants above but needed by layouts below */
 double mwfact[MAXXINERAMASCREENS][MAXWORKSPACES];
 Bool domwfact[MAXXINERAMASCREENS] = {True};
@@ -145,6 +171,35 @@ Key keys[] = {
 	{ MODKEY|ControlMask,		XK_h,		warpmouserel,	"-1" },
 };
 
+/* commands for the control socket, see README.md - undefine IPC to disable */
+#define IPC
+Command commands[] = {
+	/* name			function */
+	{ "view",		view },
+	{ "viewrel",		viewrel },
+	{ "moveto",		moveto },
+	{ "setlayout",		setlayout },
+	{ "setmwfact",		setmwfact },
+	{ "wscount",		wscount },
+	{ "segment",		setsegment },
+	{ "focusnext",		focusnext },
+	{ "focusprev",		focusprev },
+	{ "zoom",		zoom },
+	{ "togglebar",		togglebar },
+	{ "togglefloating",	togglefloating },
+	{ "togglemax",		togglemax },
+	{ "togglesticky",	togglesticky },
+	{ "togglelocked",	togglelocked },
+	{ "pushstack",		pushstack },
+	{ "popstack",		popstack },
+	{ "swapscreen",		swapscreen },
+	{ "warpmouse",		warpmouse },
+	{ "warpmouserel",	warpmouserel },
+	{ "killclient",		killclient },
+	{ "spawn",		spawn },
+	{ "quit",		quit },
+};
+
 /* key definitions for locked mode */
 Key locked_keys[] = {
 	/* modifier			key		function	argument */
@@ -13,9 +13,12 @@ MANPREFIX = $(PREFIX)/share/man
 X11INC = /usr/X11R6/include
 X11LIB = /usr/X11R6/lib
 
+# drawing code shared with dmenu
+DRAW = ../draw
+
 # includes and libs
-INCS = -I. -I/usr/include -I$(X11INC)
-LIBS = -L/usr/lib -lc -L$(X11LIB) -lX11 -lXinerama
+INCS = -I. -I$(DRAW) -I/usr/include -I$(X11INC)
+LIBS = -L/usr/lib -lc -L$(X11LIB) -lX11 -lXinerama -lXext -lXrandr
 
 # no -flto with clang
 ifeq ($(CC),clang)
@@ -20,17 +20,27 @@
  *
  * To understand everything else, start reading main().
  */
+#define _DEFAULT_SOURCE
 #include <errno.h>
-#include <locale.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/select.h>
+#include <sys/signalfd.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <regex.h>
 #include <X11/cursorfont.h>
@@ -41,6 +51,10 @@
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/Xinerama.h>
+#include <X11/extensions/Xrandr.h>
+#include <X11/extensions/sync.h>
+#include <X11/extensions/XShm.h>
+#include "draw.h"
 
 /* macros */
 #define MAX(A, B)               ((A) > (B) ? (A) : (B))
@@ -54,17 +68,21 @@
 #define ISVISIBLE(C)		((C)->workspace == selws[(C)->screen] || ((C)->workspace && (C)->issticky))
 #define LENGTH(x)		(sizeof x / sizeof x[0])
 #define MOUSEMASK		(BUTTONMASK | PointerMotionMask)
+#define MAXCONNS		16
+#define MAXWATCHES		(8 + MAXCONNS)
+#define MAXGLYPHS		256	/* UTF-8 text runs kept rendered for the MIT-SHM bar */
 
 /* constants */
 const char NULL2[] = "";  /* ugly, dirty hack for out of band communication */
 
 /* enums */
 enum { BarTop, BarBot, BarOff };			/* bar position */
+enum { PlaceOff, PlaceBestFit, PlaceLargest };		/* floating placement */
 enum { CurNormal, CurResize, CurMove, CurLast };	/* cursor */
-enum { ColBorder, ColFG, ColBG, ColEdge, ColLast };	/* color */
 enum { NetSupported, NetWMName, NetWMState,
        NetWMFullscreen, NetWMWindowType,
        NetWMWindowTypeDialog, NetWMWindowTypeSplash,
+       NetWMSyncRequest, NetWMSyncRequestCounter,
        NetLast };					/* EWMH atoms */
 enum { dwmScreen, dwmWorkspace, dwmFloating, dwmSticky,
        dwmLayout, dwmLast };				/* DWM specific atoms */
@@ -86,23 +104,32 @@ struct Client {
 	Client *prev;
 	Client *snext;
 	Window win;
+	XSyncCounter synccounter; /* _NET_WM_SYNC_REQUEST_COUNTER or None */
+	XSyncValue syncvalue;     /* last value requested from the client */
 };
 
 typedef struct {
 	int x, y, w, h;
-	unsigned long norm[ColLast];
-	unsigned long sel[ColLast];
-	unsigned long err[ColLast];
-	Drawable drawable;
-	GC gc;
-	struct {
-		int ascent;
-		int descent;
-		int height;
-		XFontSet set;
-		XFontStruct *xfont;
-	} font;
-} DC; /* draw context */
+} Rect;
+
+typedef struct {
+	Window win;
+	Rect r;			/* with borders */
+} Occupant;
+
+typedef struct {
+	Rect *r;		/* maximal empty rectangles */
+	unsigned int n, size;
+	Rect area;		/* work area these were computed for */
+	Occupant *occ;		/* floating clients taken out of the area */
+	unsigned int nocc, occsize;
+	Bool isvalid;
+} FreeRects;
+
+typedef struct {
+	int pos;		/* x or y coordinate of the edge */
+	int from, to;		/* extent of the edge in the other direction */
+} Edge;
 
 typedef struct {
 	unsigned long click;
@@ -124,6 +151,18 @@ typedef struct {
 	void (*arrange)(unsigned int screen);
 } Layout;
 
+typedef struct {
+	const char *name;
+	void (*func)(const char *arg);
+} Command; /* IPC command */
+
+typedef struct {
+	int fd;
+	Bool subscribed;
+	unsigned int len;
+	char buf[256];
+} Conn; /* IPC connection */
+
 typedef struct {
 	const char *prop;
 	Bool isfloating;
@@ -134,8 +173,32 @@ typedef struct {
 	regex_t *propregex;
 } Regs;
 
+typedef struct {
+	char text[128];
+	unsigned int w;		/* rendered width */
+	time_t updated;
+	Bool isstale;		/* drawn in ERR* colors */
+} Segment; /* part of the status text with its own update time */
+
+typedef struct Glyph Glyph;
+struct Glyph {
+	char *text;
+	unsigned int len, adv;	/* the pen moves by textnw() */
+	int x;			/* left end of the ink, relative to the pen */
+	unsigned int w;		/* width of the ink */
+	unsigned char *mask;	/* w * font height, non-zero where the text is set */
+	Glyph *next;
+}; /* rendered character or text run for the MIT-SHM bar */
+
+typedef struct {
+	int fd;
+	void (*func)(int fd);
+} Watch; /* file descriptor polled by run() */
+
 /* function declarations */
+void addwatch(int fd, void (*func)(int fd));
 void applyrules(Client *c);
+Bool applysizehints(Client *c, int *x, int *y, int *w, int *h, Bool sizehints);
 void arrange(void);
 void attach(Client *c);
 void attachstack(Client *c);
@@ -146,73 +209,117 @@ void checkotherwm(void);
 void cleanup(void);
 Bool clientiseffectivelymaximized(Client *c);
 void clientmessage(XEvent *e);
+int cmpedge(const void *a, const void *b);
 void compileregs(void);
 void configure(Client *c);
 void configurenotify(XEvent *e);
 void configurerequest(XEvent *e);
 void createbarwins(void);
+XSyncAlarm createsyncalarm(Client *c);
+void delwatch(int fd);
 void destroynotify(XEvent *e);
 void destroybarwins(void);
 void detach(Client *c);
 void detachstack(Client *c);
 void doreload(void);
 void drawbar(void);
+void drawbartext(const char *text, unsigned long col[ColLast]);
 void drawcornerpoints(int x1, int y1, int x2, int y2, unsigned long colorleft, unsigned long colorright);
-void drawtext(const char *text, unsigned long col[ColLast]);
+void drawsegment(unsigned int i);
+void drawstatus(void);
+void drawstring(int x, int y, const char *text, unsigned int len, unsigned long color);
 void *emallocz(unsigned int size);
 void enternotify(XEvent *e);
 void eprint(const char *errstr, ...);
 void expose(XEvent *e);
 void exportstatus(void);
+void fillpoint(int x, int y, unsigned long color);
+void fillrect(int x, int y, unsigned int w, unsigned int h, unsigned long color);
 void floating(unsigned int s); /* default floating layout */
 void focus(Client *c);
 void focusin(XEvent *e);
 void focusnext(const char *arg);
 void focusprev(const char *arg);
+void freeglyphs(Bool all);
+void freerect(FreeRects *f, Rect *r);
+void freeshm(void);
 Atom getatom(Window w, Atom prop);
 unsigned int getatomint(Window w, Atom prop, unsigned int initial);
 Client *getclient(Window w);
-unsigned long getcolor(const char *colstr);
+unsigned int getedges(Client *c, Edge **xedges, Edge **yedges);
 long getstate(Window w);
 Bool gettextprop(Window w, Atom prop, char *text, unsigned int size);
+Glyph *getglyph(const char *text, unsigned int len);
 void grabbuttons(Client *c, Bool focused);
 KeyCode grabkey(Key key);
 void grabkeys(void);
 void importstatus(void);
-void initfont(const char *fontstr);
+void ipcaccept(int fd);
+void ipcclose(Conn *c);
+void ipccommand(Conn *c, char *line);
+void ipcevent(const char *fmt, ...);
+void ipcnotify(void);
+void ipcquery(Conn *c);
+void ipcread(int fd);
+Bool ipcsend(Conn *c, const char *fmt, ...);
+void ipcsetup(void);
 Bool isprotodel(Client *c);
+Bool isstale(time_t updated);
+void keepmaximal(FreeRects *f, Rect *o, unsigned int n);
 void keypress(XEvent *e);
 void killclient(const char *arg);
+void loadglyphs(void);
 void leavenotify(XEvent *e);
 void manage(Window w, XWindowAttributes *wa);
 void mappingnotify(XEvent *e);
 void maprequest(XEvent *e);
 void movemouse(const char *arg);
 void moveto(const char *arg);
+unsigned int motioninterval(Client *c);
+Glyph *newglyph(const char *text, unsigned int len);
 Client *nexttiled(Client *c, unsigned int screen);
+void occupyclient(FreeRects *f, Client *c);
+void occupyrect(FreeRects *f, int x, int y, int w, int h);
+void place(Client *c);
 void popstack(const char *arg);
+void prearrange(void);
 void processrules(Client *c);
 void propertynotify(XEvent *e);
 void pushstack(const char *arg);
 void quit(const char *arg);
 void resize(Client *c, int x, int y, int w, int h, Bool sizehints);
+Bool resizeevent(Display *dsply, XEvent *ev, XPointer arg);
 void resizemouse(const char *arg);
+Bool resizesync(Client *c, XSyncAlarm alarm, Time time, int w, int h);
 void restack(void);
+void readbuiltinstatus(int fd);
+void readsignals(int fd);
+void readstatustimer(int fd);
+void renderglyphs(Glyph **g, unsigned int n);
+void renderstatus(unsigned int w);
 void run(void);
 void scan(void);
 void setborderbyfloat(Client *c, Bool configurewindow);
+void setbuiltinstatus(Bool enable);
 void setclientstate(Client *c, long state);
 void setfullscreen(Client *c, int fullscreen);
 void setlayout(const char *arg);
 void setlayout_(const char *arg, unsigned int s, unsigned int ws);
 void setmwfact(const char *arg);
+void setsegment(const char *arg);
+void setsegment_(unsigned int i, const char *text);
 void setup(void);
-void sigchld(int unused);
-void sigusr1(int unused);
+void shmcopy(int x1, int y1, int x2, int y2, unsigned int w, unsigned int h);
+void shmfill(int x, int y, unsigned int w, unsigned int h, unsigned long color);
+void sigchld(void);
+void sigusr1(void);
+int snapedges(Edge *e, unsigned int n, int pos, int size, int from, int to);
 void spawn(const char *arg);
+void statuschanged(void);
+unsigned long *statuscolor(void);
+unsigned int statuswidth(void);
 void swapscreen(const char *arg);
-unsigned int textnw(const char *text, unsigned int len);
-unsigned int textw(const char *text);
+void syncrequest(Client *c, XSyncAlarm alarm, Time time);
 void tile(unsigned int s);
 void tileleft(unsigned int s);
 void togglebar(const char *arg);
@@ -224,8 +331,13 @@ void unban(Client *c);
 void unmanage(Client *c);
 void unmapnotify(XEvent *e);
 void updatebarpos(void);
+FreeRects *updatefreerects(unsigned int s, unsigned int ws);
+void updaterefreshrates(void);
+void updateshm(void);
 void updatesizehints(Client *c);
 void updatestatus(void);
+void updatestatustimer(void);
+void updatesynccounter(Client *c);
 void updatetitle(Client *c);
 void updatewstext(int screen);
 void updatexinerama(void);
@@ -239,6 +351,7 @@ void wscount(const char *arg);
 void wscount_(int i, unsigned int s);
 int xerror(Display *dpy, XErrorEvent *ee);
 int xerrordummy(Display *dsply, XErrorEvent *ee);
+int xerrorshm(Display *dsply, XErrorEvent *ee);
 int xerrorstart(Display *dsply, XErrorEvent *ee);
 void zoom(const char *arg);
 
@@ -269,20 +382,44 @@ void (*handler[LASTEvent]) (XEvent *) = {
 };
 Atom wmatom[WMLast], netatom[NetLast], dwmatom[dwmLast];
 Bool otherwm;
+Bool prearranged = False, prearranging = False;
 Bool running = True;
 Bool reload = False;
 Bool selscreen = True;
+Bool syncextension = False;
+int syncevbase, syncerrbase;
+Bool randrextension = False;
+Bool shmextension = False, shmerror;
+XShmSegmentInfo shminfo;
+XImage *shmimg = NULL; /* bar canvas: screen s in rows s * bh, the status text below them */
+Glyph *glyphs[256];	/* text runs */
+unsigned int nglyphs = 0;
+Glyph *charglyphs[256];	/* single characters, by their byte */
+unsigned long barrequests = 0;	/* X requests sent by the last drawbar() */
+int randrevbase, randrerrbase;
 Client *clients = NULL;
 Client *sel = NULL;
 Client *stack = NULL;
 Cursor cursor[CurLast];
 Display *dpy;
-DC dc = {0};
+DC *dc;
+unsigned long normcol[ColLast], selcol[ColLast], errcol[ColLast];
 Window root;
 Regs *regs = NULL;
 char **cargv;
 Bool locked = False;
 time_t stextupdated;
+int statustimerfd = -1;
+Pixmap stextpm = None;
+unsigned int stextpmw = 0;
+Bool stextdirty = True;
+int builtinstatusfd = -1, loadavgfd = -1;
+sigset_t sigmask, origsigmask;
+Watch watches[MAXWATCHES];
+unsigned int nwatches = 0;
+Conn conns[MAXCONNS];
+int ipcfd = -1;
+char ipcpath[sizeof(((struct sockaddr_un *)0)->sun_path)];
 
 /* predefine variables depending on config.def.h */
 extern int wax[], way[], waw[], wah[];
@@ -299,10 +436,25 @@ unsigned int xine_x[MAXXINERAMASCREENS], xine_w[MAXXINERAMASCREENS]; /* xinerama
 int sx[MAXXINERAMASCREENS], sy[MAXXINERAMASCREENS], sw[MAXXINERAMASCREENS], sh[MAXXINERAMASCREENS];
 int wax[MAXXINERAMASCREENS], way[MAXXINERAMASCREENS], waw[MAXXINERAMASCREENS], wah[MAXXINERAMASCREENS];
 int wstextwidth[MAXXINERAMASCREENS];
+int statusx[MAXXINERAMASCREENS]; /* start of the status text or -1 when cut off */
+FreeRects freerects[MAXXINERAMASCREENS][MAXWORKSPACES];
+unsigned int refreshhz[MAXXINERAMASCREENS]; /* RandR refresh rate per screen */
 Window barwin[MAXXINERAMASCREENS];
+Segment segments[STATUSSEGMENTS];
+unsigned int nsegments = 0; /* non-empty ones */
+Atom segatom[STATUSSEGMENTS];
 
 
 /* function implementations */
+void
+addwatch(int fd, void (*func)(int fd)) {
+	if(nwatches == MAXWATCHES)
+		eprint("fatal: more than %d file descriptors to watch\n", MAXWATCHES);
+	watches[nwatches].fd = fd;
+	watches[nwatches].func = func;
+	nwatches++;
+}
+
 void
 applyrules(Client *c) {
 	static char buf[512];
@@ -327,6 +479,62 @@ applyrules(Client *c) {
 		XFree(ch.res_name);
 }
 
+/* applies size hints and keeps c on the screens, returns whether the
+ * geometry changes */
+Bool
+applysizehints(Client *c, int *x, int *y, int *w, int *h, Bool sizehints) {
+	if(sizehints) {
+		/* set minimum possible */
+		if (*w < 1)
+			*w = 1;
+		if (*h < 1)
+			*h = 1;
+
+		/* temporarily remove base dimensions */
+		*w -= c->basew;
+		*h -= c->baseh;
+
+		/* adjust for aspect limits */
+		if (c->minay > 0 && c->maxay > 0 && c->minax > 0 && c->maxax > 0) {
+			if (*w * c->maxay > *h * c->maxax)
+				*w = *h * c->maxax / c->maxay;
+			else if (*w * c->minay < *h * c->minax)
+				*h = *w * c->minay / c->minax;
+		}
+
+		/* adjust for increment value */
+		if(c->incw)
+			*w -= *w % c->incw;
+		if(c->inch)
+			*h -= *h % c->inch;
+
+		/* restore base dimensions */
+		*w += c->basew;
+		*h += c->baseh;
+
+		if(c->minw > 0 && *w < c->minw)
+			*w = c->minw;
+		if(c->minh > 0 && *h < c->minh)
+			*h = c->minh;
+		if(c->maxw > 0 && *w > c->maxw)
+			*w = c->maxw;
+		if(c->maxh > 0 && *h > c->maxh)
+			*h = c->maxh;
+	}
+	if(*w <= 0 || *h <= 0)
+		return False;
+	/* offscreen appearance fixes */
+	if(*x > totalw)
+		*x = totalw - *w - 2 * c->border;
+	if(*y > totalh)
+		*y = totalh - *h - 2 * c->border;
+	if(*x + *w + 2 * c->border < totalx)
+		*x = totalx;
+	if(*y + *h + 2 * c->border < totaly)
+		*y = totaly;
+	return c->x != *x || c->y != *y || c->w != *w || c->h != *h;
+}
+
 void
 arrange(void) {
 	Client *c;
@@ -339,6 +547,7 @@ arrange(void) {
 			ban(c);
 	for(s = 0; s < screenmax; s++)
 		layout[s][selws[s]-1]->arrange(s);
+	prearranged = False;
 	focus(NULL);
 	restack();
 }
@@ -380,8 +589,8 @@ buttonpress(XEvent *e) {
 	else for(s = 0; s < screenmax; s++)
 		     if(ev->window == barwin[s]) {
 			     /* FIXME: textw() is computed all over again and again… */
-			     x = textw(wstext[s]);
-			     stextw = textw(stext);
+			     x = textw(dc, wstext[s]);
+			     stextw = statuswidth();
 			     if(ev->x < x)
 				     click = ClkWsNumber;
 			     else if(ev->x < x + blw)
@@ -442,19 +651,21 @@ cleanup(void) {
 		unban(stack);
 		unmanage(stack);
 	}
-	if(dc.font.set)
-		XFreeFontSet(dpy, dc.font.set);
-	else
-		XFreeFont(dpy, dc.font.xfont);
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
-	XFreePixmap(dpy, dc.drawable);
-	XFreeGC(dpy, dc.gc);
+	if(stextpm)
+		XFreePixmap(dpy, stextpm);
+	freeshm();
+	freeglyphs(True);
 	destroybarwins();
 	XFreeCursor(dpy, cursor[CurNormal]);
 	XFreeCursor(dpy, cursor[CurResize]);
 	XFreeCursor(dpy, cursor[CurMove]);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XSync(dpy, False);
+	if(ipcfd >= 0) {
+		close(ipcfd);
+		unlink(ipcpath);
+	}
 }
 
 Bool
@@ -504,6 +715,11 @@ clientmessage(XEvent *e)
 				      || (cme->data.l[0] == 2 /* _NET_WM_STATE_TOGGLE */ && !c->ismax)));
 }
 
+int
+cmpedge(const void *a, const void *b) {
+	return ((const Edge *)a)->pos - ((const Edge *)b)->pos;
+}
+
 void
 compileregs(void) {
 	unsigned int i;
@@ -548,6 +764,8 @@ configurenotify(XEvent *e) {
 	if(ev->window == root) {
 		destroybarwins();
 		updatexinerama();
+		updaterefreshrates();
+		updateshm();
 		createbarwins();
 		arrange();
 	}
@@ -620,6 +838,24 @@ createbarwins(void) {
 	XSync(dpy, False);
 }
 
+/* Creates an alarm that fires once the client has acknowledged the last
+ * _NET_WM_SYNC_REQUEST by raising its counter to c->syncvalue. */
+XSyncAlarm
+createsyncalarm(Client *c) {
+	XSyncAlarmAttributes aa;
+
+	if(!XSyncQueryCounter(dpy, c->synccounter, &c->syncvalue))
+		return None;
+	aa.trigger.counter = c->synccounter;
+	aa.trigger.value_type = XSyncAbsolute;
+	aa.trigger.wait_value = c->syncvalue;
+	aa.trigger.test_type = XSyncPositiveComparison;
+	XSyncIntToValue(&aa.delta, 0);
+	aa.events = True;
+	return XSyncCreateAlarm(dpy, XSyncCACounter | XSyncCAValueType | XSyncCAValue
+				| XSyncCATestType | XSyncCADelta | XSyncCAEvents, &aa);
+}
+
 void
 destroybarwins(void) {
 	unsigned int s;
@@ -628,6 +864,17 @@ destroybarwins(void) {
 		XDestroyWindow(dpy, barwin[s]);
 }
 
+void
+delwatch(int fd) {
+	unsigned int i;
+
+	for(i = 0; i < nwatches; i++)
+		if(watches[i].fd == fd) {
+			watches[i] = watches[--nwatches];
+			return;
+		}
+}
+
 void
 destroynotify(XEvent *e) {
 	Client *c;
@@ -658,6 +905,7 @@ detachstack(Client *c) {
 
 void
 doreload(void) {
+	sigprocmask(SIG_SETMASK, &origsigmask, NULL);
 	execvp(cargv[0], cargv);
 	eprint("Can't exec: %s\n", strerror(errno));
 }
@@ -665,9 +913,9 @@ doreload(void) {
 void
 drawbar(void) {
 	int x;
-	unsigned int s;
+	unsigned int s, stextw;
 	char buf[258];
-	unsigned long *stextcol;
+	unsigned long *stextcol, req = NextRequest(dpy);
 
 #ifdef SHOWSTACKSIZE
 	Client *c;
@@ -678,110 +926,192 @@ drawbar(void) {
 			stacksize++;
 #endif
 
-	if (STATUSBARTIMEOUT > 0 && time(NULL) - stextupdated > STATUSBARTIMEOUT)
-		stextcol = dc.err;
-	else
-		stextcol = dc.norm;
+	stextcol = statuscolor();
+	stextw = statuswidth();
+	if(stextdirty || stextw != stextpmw)
+		renderstatus(stextw);
 
 	for(s = 0; s < screenmax; s++) {
-		dc.x = dc.y = 0;
-		dc.w = wstextwidth[s];
-		drawtext(wstext[s], dc.norm);
-		dc.x = dc.w;
-		dc.w = blw;
-		drawtext(layout[s][selws[s]-1]->symbol, dc.norm);
-		x = dc.x + dc.w;
+		dc->x = 0;
+		dc->y = shmimg ? s * bh : 0;
+		dc->w = wstextwidth[s];
+		drawbartext(wstext[s], normcol);
+		dc->x = dc->w;
+		dc->w = blw;
+		drawbartext(layout[s][selws[s]-1]->symbol, normcol);
+		x = dc->x + dc->w;
 		if(locked) {
-			dc.x = x;
+			dc->x = x;
 			/* FIXME: textw() is computed all over again and again… */
-			dc.w = textw(lockedstat);
-			drawtext(lockedstat, dc.norm);
-			x += dc.w;
+			dc->w = textw(dc, lockedstat);
+			drawbartext(lockedstat, normcol);
+			x += dc->w;
 		}
 #ifdef SHOWSTACKSIZE
 		if(stacksize) {
 			snprintf(buf, sizeof buf, "_%u", stacksize);
-			dc.x = x;
-			dc.w = textw(buf);
-			drawtext(buf, dc.norm);
-			x += dc.w;
+			dc->x = x;
+			dc->w = textw(dc, buf);
+			drawbartext(buf, normcol);
+			x += dc->w;
 		}
 #endif
-		dc.w = textw(stext);
-		dc.x = sw[s] - dc.w;
-		if(dc.x < x) {
-			dc.x = x;
-			dc.w = sw[s] - x;
+		dc->w = stextw;
+		dc->x = statusx[s] = sw[s] - dc->w;
+		if(dc->x < x) {
+			dc->x = x;
+			dc->w = sw[s] - x;
+			statusx[s] = -1;
+			drawstatus();
+		}
+		else if(shmimg)
+			shmcopy(0, screenmax * bh, dc->x, dc->y, dc->w, bh);
+		else {
+			flushdc(dc);
+			XCopyArea(dpy, stextpm, dc->canvas, dc->gc, 0, 0, dc->w, bh, dc->x, 0);
 		}
-		drawtext(stext, stextcol);
-		if((dc.w = dc.x - x) > bh) {
-			dc.x = x;
+		if((dc->w = dc->x - x) > bh) {
+			dc->x = x;
 			if(sel && sel->screen == s) {
 				snprintf(buf, sizeof buf, "%c %s",
 					 clientstat[ sel->isfloating | sel->issticky << 1 ],
 					 sel->name
 					);
-				drawtext(buf, dc.sel);
-				drawcornerpoints(x, 0, x + dc.w - 1, bh - 1, dc.norm[ColBG], stextcol[ColBG]);
+				drawbartext(buf, selcol);
+				drawcornerpoints(x, dc->y, x + dc->w - 1, dc->y + bh - 1, normcol[ColBG], stextcol[ColBG]);
 			}
 			else
-				drawtext(NULL, dc.norm);
+				drawbartext(NULL, normcol);
 		}
-		XCopyArea(dpy, dc.drawable, barwin[s], dc.gc, 0, 0, sw[s], bh, 0, 0);
+		flushdc(dc);
+		if(shmimg)
+			XShmPutImage(dpy, barwin[s], dc->gc, shmimg, 0, dc->y, 0, 0, sw[s], bh, False);
+		else
+			XCopyArea(dpy, dc->canvas, barwin[s], dc->gc, 0, 0, sw[s], bh, 0, 0);
 	}
-	XSync(dpy, False);
+	dc->y = 0;
+	barrequests = NextRequest(dpy) - req;
+	XSync(dpy, False); /* also keeps shmimg from being changed while it is read */
+	ipcnotify();
+}
+
+/* draws text into dc->x, dc->w, shortened with "..." if necessary */
+void
+drawbartext(const char *text, unsigned long col[ColLast]) {
+	char buf[256];
+	unsigned int len;
+	int w, h = dc->font.height;
+
+	fillrect(dc->x, dc->y, dc->w, dc->h, col[ColBG]);
+	if(!text)
+		return;
+	len = strlen(text);
+	if(len > sizeof buf - 4 || textnw(dc, text, len) > dc->w - h) {
+		if((w = dc->w - h - textnw(dc, "...", 3)) < 0)
+			return; /* too long */
+		len = textfit(dc, text, MIN(len, sizeof buf - 4), w);
+		memcpy(buf, text, len);
+		memcpy(buf + len, "...", 3);
+		len += 3;
+	}
+	else
+		memcpy(buf, text, len);
+	drawstring(dc->x + h / 2, dc->y + (dc->h / 2) - (h / 2) + dc->font.ascent, buf, len, col[ColFG]);
 }
 
 void
 drawcornerpoints(int x1, int y1, int x2, int y2, unsigned long colorleft, unsigned long colorright) {
-	XSetForeground(dpy, dc.gc, colorleft);
-	XDrawPoint(dpy, dc.drawable, dc.gc, x1, y1);
-	XDrawPoint(dpy, dc.drawable, dc.gc, x1, y2);
+	fillpoint(x1, y1, colorleft);
+	fillpoint(x1, y2, colorleft);
+	fillpoint(x2, y1, colorright);
+	fillpoint(x2, y2, colorright);
+}
+
+/* redraws only segment i into stextpm and copies it to all screens, or
+ * redraws the whole bar if its position is unknown */
+void
+drawsegment(unsigned int i) {
+	Drawable d = dc->canvas;
+	unsigned int s, j;
+	int x;
 
-	if (colorleft != colorright)
-		XSetForeground(dpy, dc.gc, colorright);
-	XDrawPoint(dpy, dc.drawable, dc.gc, x2, y1);
-	XDrawPoint(dpy, dc.drawable, dc.gc, x2, y2);
+	for(s = 0; s < screenmax; s++)
+		if(statusx[s] < 0 || stextdirty) {
+			drawbar();
+			return;
+		}
+	for(x = 0, j = 0; j < i; j++)
+		x += segments[j].w;
+	dc->canvas = stextpm;
+	dc->x = x;
+	dc->y = shmimg ? screenmax * bh : 0;
+	dc->w = segments[i].w;
+	drawbartext(segments[i].text, segments[i].isstale ? errcol : normcol);
+	flushdc(dc);
+	dc->canvas = d;
+	for(s = 0; s < screenmax; s++)
+		if(shmimg) {
+			shmcopy(x, dc->y, statusx[s] + x, s * bh, dc->w, bh);
+			XShmPutImage(dpy, barwin[s], dc->gc, shmimg, statusx[s] + x, s * bh,
+				     statusx[s] + x, 0, dc->w, bh, False);
+		}
+		else
+			XCopyArea(dpy, stextpm, barwin[s], dc->gc, x, 0, dc->w, bh, statusx[s] + x, 0);
+	dc->y = 0;
+	XSync(dpy, False);
 }
 
+/* draws the status text or its segments into dc->x, dc->w */
 void
-drawtext(const char *text, unsigned long col[ColLast]) {
-	int x, y, w, h;
-	static char buf[256];
-	unsigned int len, olen;
-	XRectangle r = { dc.x, dc.y, dc.w, dc.h };
+drawstatus(void) {
+	int x = dc->x, w = dc->w;
+	unsigned int i;
 
-	XSetForeground(dpy, dc.gc, col[ColBG]);
-	XFillRectangles(dpy, dc.drawable, dc.gc, &r, 1);
-	if(!text)
+	if(!nsegments) {
+		drawbartext(stext, statuscolor());
 		return;
-	w = 0;
-	olen = len = strlen(text);
-	if(len >= sizeof buf)
-		len = sizeof buf - 1;
-	memcpy(buf, text, len);
-	buf[len] = 0;
-	h = dc.font.ascent + dc.font.descent;
-	y = dc.y + (dc.h / 2) - (h / 2) + dc.font.ascent;
-	x = dc.x + (h / 2);
-	/* shorten text if necessary */
-	while(len && (w = textnw(buf, len)) > dc.w - h)
-		buf[--len] = 0;
-	if(len < olen) {
-		if(len > 1)
-			buf[len - 1] = '.';
-		if(len > 2)
-			buf[len - 2] = '.';
-		if(len > 3)
-			buf[len - 3] = '.';
-	}
-	if(w > dc.w)
-		return; /* too long */
-	XSetForeground(dpy, dc.gc, col[ColFG]);
-	if(dc.font.set)
-		Xutf8DrawString(dpy, dc.drawable, dc.font.set, dc.gc, x, y, buf, len);
-	else
-		XDrawString(dpy, dc.drawable, dc.gc, x, y, buf, len);
+	}
+	for(i = 0; i < STATUSSEGMENTS && dc->x < x + w; i++) {
+		if(!segments[i].w)
+			continue;
+		dc->w = MIN(segments[i].w, x + w - dc->x);
+		drawbartext(segments[i].text, segments[i].isstale ? errcol : normcol);
+		dc->x += dc->w;
+	}
+	dc->x = x;
+	dc->w = w;
+}
+
+/* with MIT-SHM the rendered characters are copied into shmimg client-side */
+void
+drawstring(int x, int y, const char *text, unsigned int len, unsigned long color) {
+	Glyph *g;
+	unsigned int i, n, gx, gy, end;
+	unsigned char *m;
+
+	if(!shmimg) {
+		flushdc(dc);
+		setforeground(dc, color);
+		if(dc->font.set)
+			Xutf8DrawString(dpy, dc->canvas, dc->font.set, dc->gc, x, y, text, len);
+		else
+			XDrawString(dpy, dc->canvas, dc->gc, x, y, text, len);
+		return;
+	}
+	y -= dc->font.ascent;
+	for(i = 0; i < len; i += n, x += g->adv) {
+		/* non-ASCII characters are rendered together with the character
+		 * before them, to keep combining characters and their spacing */
+		for(n = 1; dc->font.set && i + n < len && (text[i + n] & 0x80); n++);
+		g = getglyph(text + i, n);
+		for(gy = 0, m = g->mask; gy < dc->font.height; gy++, m += g->w)
+			for(gx = 0; gx < g->w; gx = end) {
+				for(; gx < g->w && !m[gx]; gx++);
+				for(end = gx; end < g->w && m[end]; end++);
+				if(end > gx)
+					shmfill(x + g->x + gx, y + gy, end - gx, 1, color);
+			}
+	}
 }
 
 void *
@@ -859,6 +1189,25 @@ expose(XEvent *e) {
 			}
 }
 
+/* like drawpoint() and drawrect(), but at bar coordinates and into shmimg
+ * if there is one */
+void
+fillpoint(int x, int y, unsigned long color) {
+	if(shmimg)
+		shmfill(x, y, 1, 1, color);
+	else
+		drawpoint(dc, x - dc->x, y - dc->y, color);
+}
+
+void
+fillrect(int x, int y, unsigned int w, unsigned int h, unsigned long color) {
+	if(shmimg) {
+		shmfill(x, y, w, h, color);
+		return;
+	}
+	drawrect(dc, x - dc->x, y - dc->y, w, h, color);
+}
+
 void
 floating(unsigned int s) { /* default floating layout */
 	Client *c;
@@ -882,7 +1231,7 @@ focus(Client *c) {
 	}
 	if(sel && sel != c) {
 		grabbuttons(sel, False);
-		XSetWindowBorder(dpy, sel->win, dc.norm[ColBorder]);
+		XSetWindowBorder(dpy, sel->win, normcol[ColBorder]);
 	}
 	if(c) {
 		detachstack(c);
@@ -894,7 +1243,7 @@ focus(Client *c) {
 	if(!selscreen)
 		return;
 	if(c) {
-		XSetWindowBorder(dpy, c->win, dc.sel[ColBorder]);
+		XSetWindowBorder(dpy, c->win, selcol[ColBorder]);
 		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
 	}
 	else
@@ -941,6 +1290,67 @@ focusprev(const char *arg) {
 	}
 }
 
+/* frees the text runs, and with all the single characters as well */
+void
+freeglyphs(Bool all) {
+	Glyph *g;
+	unsigned int i;
+
+	for(i = 0; i < LENGTH(glyphs); i++)
+		while((g = glyphs[i]) || (all && (g = charglyphs[i]))) {
+			if(g == glyphs[i])
+				glyphs[i] = g->next;
+			else
+				charglyphs[i] = NULL;
+			free(g->text);
+			free(g->mask);
+			free(g);
+		}
+	nglyphs = 0;
+}
+
+/* Marks the area of a removed or changed client as free again.  The old
+ * rectangles all stay free; new maximal ones can only pass through the freed
+ * area, so just those are cut from the work area by the other clients, and
+ * any old rectangle one of them contains is dropped. */
+void
+freerect(FreeRects *f, Rect *r) {
+	FreeRects t;
+	Rect *o;
+	unsigned int i, j, n;
+
+	memset(&t, 0, sizeof t);
+	t.r = emallocz(sizeof(Rect));
+	t.r[0] = f->area;
+	t.n = t.size = 1;
+	for(i = 0; i < f->nocc && t.n; i++) {
+		occupyrect(&t, f->occ[i].r.x, f->occ[i].r.y, f->occ[i].r.w, f->occ[i].r.h);
+		for(j = n = 0; j < t.n; j++)
+			if(t.r[j].x < r->x + r->w && r->x < t.r[j].x + t.r[j].w
+			&& t.r[j].y < r->y + r->h && r->y < t.r[j].y + t.r[j].h)
+				t.r[n++] = t.r[j];
+		t.n = n;
+	}
+	o = emallocz((f->n + t.n + 1) * sizeof(Rect));
+	memcpy(o, f->r, f->n * sizeof(Rect));
+	memcpy(o + f->n, t.r, t.n * sizeof(Rect));
+	keepmaximal(f, o, f->n + t.n);
+	free(o);
+	free(t.r);
+}
+
+void
+freeshm(void) {
+	if(!shmimg)
+		return;
+	XShmDetach(dpy, &shminfo);
+	XSync(dpy, False);
+	shmdt(shminfo.shmaddr);
+	shmimg->data = NULL;
+	XDestroyImage(shmimg);
+	shmimg = NULL;
+}
+
 Atom
 getatom(Window w, Atom prop)
 {
@@ -983,14 +1393,95 @@ getclient(Window w) {
 	return c;
 }
 
-unsigned long
-getcolor(const char *colstr) {
-	Colormap cmap = DefaultColormap(dpy, screen);
-	XColor color;
+/* Collects the screen borders and the borders of all other visible clients
+ * as snapping targets for c, both arrays sorted by position.  The arrays
+ * are resized to the current number of clients, which may have grown since
+ * the last call. */
+unsigned int
+getedges(Client *c, Edge **xedgesp, Edge **yedgesp) {
+	unsigned int n = 0;
+	int bartop = (bpos == BarTop) ? bh : 0;
+	int barbot = (bpos == BarBot) ? bh : 0;
+	Edge *xedges, *yedges;
+	Client *t;
+#ifdef SNAPLOCALBORDERS
+	unsigned int s;
+#endif
+
+	/* two edges per screen, for the whole screen and per client */
+	for(n = screenmax + 1, t = clients; t; t = t->next, n++);
+	if(!(xedges = *xedgesp = realloc(*xedgesp, 2 * n * sizeof(Edge)))
+	|| !(yedges = *yedgesp = realloc(*yedgesp, 2 * n * sizeof(Edge))))
+		eprint("fatal: could not realloc() %u bytes\n", 2 * n * (unsigned int)sizeof(Edge));
+	n = 0;
+#ifdef SNAPLOCALBORDERS
 
-	if(!XAllocNamedColor(dpy, cmap, colstr, &color, &color))
-		eprint("error, cannot allocate color '%s'\n", colstr);
-	return color.pixel;
+	/* snap to ALL the borders! */
+	for(s = 0; s < screenmax; s++) {
+		xedges[n].pos = sx[s];
+		xedges[n+1].pos = sx[s] + sw[s];
+		yedges[n].pos = sy[s] + bartop;
+		yedges[n+1].pos = sy[s] + sh[s] - barbot;
+		xedges[n].from = xedges[n+1].from = yedges[n].from = yedges[n+1].from = INT_MIN;
+		xedges[n].to = xedges[n+1].to = yedges[n].to = yedges[n+1].to = INT_MAX;
+		n += 2;
+	}
+#else
+	xedges[n].pos = totalx;
+	xedges[n+1].pos = totalx + totalw;
+	yedges[n].pos = totaly + bartop;
+	yedges[n+1].pos = totaly + totalh - barbot;
+	xedges[n].from = xedges[n+1].from = yedges[n].from = yedges[n+1].from = INT_MIN;
+	xedges[n].to = xedges[n+1].to = yedges[n].to = yedges[n+1].to = INT_MAX;
+	n += 2;
+#endif
+#ifdef SNAPCLIENTS
+	for(t = clients; t; t = t->next) {
+		if(t == c || t->isbanned || !ISVISIBLE(t))
+			continue;
+		xedges[n].pos = t->x;
+		xedges[n+1].pos = t->x + t->w + 2 * t->border;
+		xedges[n].from = xedges[n+1].from = t->y;
+		xedges[n].to = xedges[n+1].to = t->y + t->h + 2 * t->border;
+		yedges[n].pos = t->y;
+		yedges[n+1].pos = t->y + t->h + 2 * t->border;
+		yedges[n].from = yedges[n+1].from = t->x;
+		yedges[n].to = yedges[n+1].to = t->x + t->w + 2 * t->border;
+		n += 2;
+	}
+#endif
+	qsort(xedges, n, sizeof(Edge), cmpedge);
+	qsort(yedges, n, sizeof(Edge), cmpedge);
+	return n;
+}
+
+/* A single byte is a character, rendered once for good.  Runs of UTF-8
+ * text are kept until the cache is full, as titles keep changing. */
+Glyph *
+getglyph(const char *text, unsigned int len) {
+	Glyph *g;
+	unsigned int i, key = len;
+
+	if(len == 1) {
+		if(!(g = charglyphs[(unsigned char)*text])) {
+			g = charglyphs[(unsigned char)*text] = newglyph(text, len);
+			renderglyphs(&g, 1);
+		}
+		return g;
+	}
+	for(i = 0; i < len; i++)
+		key = key * 31 + (unsigned char)text[i];
+	for(g = glyphs[key % LENGTH(glyphs)]; g; g = g->next)
+		if(g->len == len && !memcmp(g->text, text, len))
+			return g;
+	if(nglyphs == MAXGLYPHS)
+		freeglyphs(False);
+	nglyphs++;
+	g = newglyph(text, len);
+	renderglyphs(&g, 1);
+	g->next = glyphs[key % LENGTH(glyphs)];
+	glyphs[key % LENGTH(glyphs)] = g;
+	return g;
 }
 
 long
@@ -1141,43 +1632,219 @@ importstatus(void) {
 }
 
 void
-initfont(const char *fontstr) {
-	char *def, **missing;
-	int i, n;
-	XFontStruct **xfonts;
-	char **font_names;
-
-	missing = NULL;
-	if(dc.font.set)
-		XFreeFontSet(dpy, dc.font.set);
-	dc.font.set = XCreateFontSet(dpy, fontstr, &missing, &n, &def);
-	if(missing) {
-		while(n--)
-			fprintf(stderr, "dwm: missing fontset: %s\n", missing[n]);
-		XFreeStringList(missing);
-	}
-	if(dc.font.set) {
-		dc.font.ascent = dc.font.descent = 0;
-		n = XFontsOfFontSet(dc.font.set, &xfonts, &font_names);
-		for(i = 0, dc.font.ascent = 0, dc.font.descent = 0; i < n; i++) {
-			if(dc.font.ascent < (*xfonts)->ascent)
-				dc.font.ascent = (*xfonts)->ascent;
-			if(dc.font.descent < (*xfonts)->descent)
-				dc.font.descent = (*xfonts)->descent;
-			xfonts++;
+ipcaccept(int fd) {
+	int cfd;
+	unsigned int i;
+
+	if((cfd = accept(fd, NULL, NULL)) < 0)
+		return;
+	for(i = 0; i < MAXCONNS && conns[i].fd >= 0; i++);
+	if(i == MAXCONNS) {
+		close(cfd);
+		return;
+	}
+	fcntl(cfd, F_SETFL, O_NONBLOCK);
+	fcntl(cfd, F_SETFD, FD_CLOEXEC);
+	conns[i].fd = cfd;
+	conns[i].subscribed = False;
+	conns[i].len = 0;
+	addwatch(cfd, ipcread);
+}
+
+void
+ipcclose(Conn *c) {
+	delwatch(c->fd);
+	close(c->fd);
+	c->fd = -1;
+}
+
+/* executes one line of the IPC protocol: "<command> [<argument>]" */
+void
+ipccommand(Conn *c, char *line) {
+	char *arg;
+	unsigned int i;
+
+	if((arg = strchr(line, ' '))) {
+		*arg++ = '\0';
+		if(!*arg)
+			arg = NULL;
+	}
+	if(!strcmp(line, "query")) {
+		ipcquery(c);
+		return;
+	}
+	if(!strcmp(line, "subscribe")) {
+		c->subscribed = True;
+		ipcsend(c, "ok\n");
+		return;
+	}
+	for(i = 0; i < LENGTH(commands); i++)
+		if(!strcmp(line, commands[i].name)) {
+			commands[i].func(arg);
+			ipcsend(c, "ok\n");
+			return;
+		}
+	ipcsend(c, "error unknown command '%s'\n", line);
+}
+
+/* sends an event line to all subscribed connections */
+void
+ipcevent(const char *fmt, ...) {
+	char buf[512];
+	va_list ap;
+	unsigned int i;
+
+	if(ipcfd < 0)
+		return;
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	for(i = 0; i < MAXCONNS; i++)
+		if(conns[i].fd >= 0 && conns[i].subscribed)
+			ipcsend(&conns[i], "event %s\n", buf);
+}
+
+/* reports changes since the last call to subscribers, called from drawbar() */
+void
+ipcnotify(void) {
+	static unsigned int lastws[MAXXINERAMASCREENS], lastcount[MAXXINERAMASCREENS];
+	static Layout *lastlayout[MAXXINERAMASCREENS];
+	static Window lastsel = None;
+	unsigned int s;
+
+	if(ipcfd < 0)
+		return;
+	for(s = 0; s < screenmax; s++) {
+		if(lastws[s] != selws[s] || lastcount[s] != workspaces[s]) {
+			lastws[s] = selws[s];
+			lastcount[s] = workspaces[s];
+			ipcevent("workspace %u %u %u", s, selws[s], workspaces[s]);
+		}
+		if(lastlayout[s] != layout[s][selws[s]-1]) {
+			lastlayout[s] = layout[s][selws[s]-1];
+			ipcevent("layout %u %s", s, lastlayout[s]->symbol);
 		}
 	}
-	else {
-		if(dc.font.xfont)
-			XFreeFont(dpy, dc.font.xfont);
-		dc.font.xfont = NULL;
-		if(!(dc.font.xfont = XLoadQueryFont(dpy, fontstr))
-		&& !(dc.font.xfont = XLoadQueryFont(dpy, "fixed")))
-			eprint("error, cannot load font: '%s'\n", fontstr);
-		dc.font.ascent = dc.font.xfont->ascent;
-		dc.font.descent = dc.font.xfont->descent;
+	if(lastsel != (sel ? sel->win : None)) {
+		lastsel = sel ? sel->win : None;
+		ipcevent("focus 0x%lx %s", lastsel, sel ? sel->name : "");
 	}
-	dc.font.height = dc.font.ascent + dc.font.descent;
+}
+
+void
+ipcquery(Conn *c) {
+	Client *t;
+	unsigned int s, cur = whichscreen();
+
+	for(s = 0; s < screenmax; s++)
+		if(!ipcsend(c, "screen %u %u %u %s %.2f%s\n", s, selws[s], workspaces[s],
+			    layout[s][selws[s]-1]->symbol, mwfact[s][selws[s]-1], s == cur ? " current" : ""))
+			return;
+	for(t = clients; t; t = t->next)
+		if(!ipcsend(c, "client 0x%lx %u %u %c%s %s\n", t->win, t->screen, t->workspace,
+			    clientstat[t->isfloating | t->issticky << 1], t == sel ? " focused" : "", t->name))
+			return;
+	if(ipcsend(c, "status %s\n", stext)
+	&& ipcsend(c, "bar %lu\n", barrequests))
+		ipcsend(c, "ok\n");
+}
+
+void
+ipcread(int fd) {
+	Conn *c;
+	char *line, *nl;
+	ssize_t n;
+	unsigned int i;
+
+	for(i = 0; i < MAXCONNS && conns[i].fd != fd; i++);
+	if(i == MAXCONNS)
+		return;
+	c = &conns[i];
+	if((n = read(fd, c->buf + c->len, sizeof c->buf - c->len)) <= 0) {
+		if(n == 0 || (errno != EAGAIN && errno != EINTR))
+			ipcclose(c);
+		return;
+	}
+	c->len += n;
+	for(line = c->buf; (nl = memchr(line, '\n', c->len - (line - c->buf))); line = nl + 1) {
+		*nl = '\0';
+		ipccommand(c, line);
+		if(c->fd != fd) /* closed while answering */
+			return;
+	}
+	c->len -= line - c->buf;
+	memmove(c->buf, line, c->len);
+	if(c->len == sizeof c->buf) {
+		ipcsend(c, "error line too long\n");
+		ipcclose(c);
+	}
+}
+
+/* sends one line, control characters from titles and the status text
+ * become spaces; never blocks: a connection that can't keep up is closed */
+Bool
+ipcsend(Conn *c, const char *fmt, ...) {
+	char buf[1024];
+	va_list ap;
+	int len, i;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	if(len < 0)
+		return False;
+	if(len >= (int)sizeof buf) {
+		len = sizeof buf - 1;
+		buf[len - 1] = '\n';
+	}
+	for(i = 0; i < len - 1; i++)
+		if((unsigned char)buf[i] < ' ' || buf[i] == 0x7f)
+			buf[i] = ' ';
+	if(send(c->fd, buf, len, MSG_NOSIGNAL) != len) {
+		ipcclose(c);
+		return False;
+	}
+	return True;
+}
+
+/* listens on $XDG_RUNTIME_DIR/dwm-$DISPLAY.sock, exported as $DWM_SOCKET */
+void
+ipcsetup(void) {
+	struct sockaddr_un sa;
+	const char *dir;
+	char *p;
+	unsigned int i;
+
+	for(i = 0; i < MAXCONNS; i++)
+		conns[i].fd = -1;
+	if(!(dir = getenv("XDG_RUNTIME_DIR")))
+		return;
+	if(snprintf(ipcpath, sizeof ipcpath, "%s/dwm-%s.sock", dir, DisplayString(dpy))
+	>= (int)sizeof ipcpath) {
+		fprintf(stderr, "dwm: can't listen on %s/dwm-%s.sock: path too long\n",
+			dir, DisplayString(dpy));
+		ipcpath[0] = '\0';
+		return;
+	}
+	for(p = ipcpath + strlen(dir) + 1; *p; p++)
+		if(*p == '/')
+			*p = '_';
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family = AF_UNIX;
+	memcpy(sa.sun_path, ipcpath, sizeof sa.sun_path);
+	unlink(ipcpath);
+	if((ipcfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0
+	|| bind(ipcfd, (struct sockaddr *)&sa, sizeof sa) < 0
+	|| chmod(ipcpath, S_IRUSR | S_IWUSR) < 0
+	|| listen(ipcfd, MAXCONNS) < 0) {
+		fprintf(stderr, "dwm: can't listen on %s: %s\n", ipcpath, strerror(errno));
+		if(ipcfd >= 0)
+			close(ipcfd);
+		ipcfd = -1;
+		return;
+	}
+	setenv("DWM_SOCKET", ipcpath, 1);
+	addwatch(ipcfd, ipcaccept);
 }
 
 Bool
@@ -1195,6 +1862,34 @@ isprotodel(Client *c) {
 	return ret;
 }
 
+Bool
+isstale(time_t updated) {
+	return STATUSBARTIMEOUT > 0 && time(NULL) - updated > STATUSBARTIMEOUT;
+}
+
+/* Replaces the rectangles of f with those of the n in o that no other one
+ * contains, of equal ones the first. */
+void
+keepmaximal(FreeRects *f, Rect *o, unsigned int n) {
+	unsigned int i, j;
+
+	for(f->n = i = 0; i < n; i++) {
+		for(j = 0; j < n; j++)
+			if(j != i && o[j].x <= o[i].x && o[j].y <= o[i].y
+			&& o[j].x + o[j].w >= o[i].x + o[i].w && o[j].y + o[j].h >= o[i].y + o[i].h
+			&& (j < i || o[j].x != o[i].x || o[j].y != o[i].y || o[j].w != o[i].w || o[j].h != o[i].h))
+				break;
+		if(j < n)
+			continue;
+		if(f->n == f->size) {
+			f->size = f->size ? 2 * f->size : 16;
+			if(!(f->r = realloc(f->r, f->size * sizeof(Rect))))
+				eprint("fatal: could not realloc() %u bytes\n", f->size * (unsigned int)sizeof(Rect));
+		}
+		f->r[f->n++] = o[i];
+	}
+}
+
 void
 keypress(XEvent *e) {
 	unsigned int i;
@@ -1253,6 +1948,19 @@ leavenotify(XEvent *e) {
 	}
 }
 
+/* renders the printable ASCII characters for the MIT-SHM bar, all at once */
+void
+loadglyphs(void) {
+	Glyph *g[0x7f - ' '];
+	unsigned int n;
+	char c;
+
+	for(n = 0, c = ' '; c < 0x7f; c++)
+		if(!charglyphs[(unsigned char)c])
+			g[n++] = charglyphs[(unsigned char)c] = newglyph(&c, 1);
+	renderglyphs(g, n);
+}
+
 void
 manage(Window w, XWindowAttributes *wa) {
 	Client *c, *t = NULL;
@@ -1286,10 +1994,11 @@ manage(Window w, XWindowAttributes *wa) {
 			c->y = way[s];
 		c->border = BORDERPX;
 	}
-	XSetWindowBorder(dpy, w, dc.norm[ColBorder]);
+	XSetWindowBorder(dpy, w, normcol[ColBorder]);
 	if (wtype == netatom[NetWMWindowTypeDialog] || wtype == netatom[NetWMWindowTypeSplash])
 		c->isfloating = True;
 	updatesizehints(c);
+	updatesynccounter(c);
 	XSelectInput(dpy, w, EnterWindowMask | FocusChangeMask | PropertyChangeMask | StructureNotifyMask);
 	grabbuttons(c, False);
 	updatetitle(c);
@@ -1299,6 +2008,13 @@ manage(Window w, XWindowAttributes *wa) {
 	if(!c->isfloating)
 		c->isfloating = (rettrans == Success) || c->isfixed;
 	setborderbyfloat(c, True);
+	/* don't shuffle windows that were already mapped before a restart,
+	 * transients stay where their parent wants them */
+	if(PLACEMENT != PlaceOff && wa->map_state != IsViewable && !(c->flags & USPosition)
+	&& rettrans != Success
+	&& (c->isfloating || layout[s][c->workspace-1]->arrange == floating)
+	&& !(c->w == sw[s] && c->h == sh[s]))
+		place(c);
 	attach(c);
 	attachstack(c);
 	XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h); /* some windows require this */
@@ -1333,15 +2049,11 @@ maprequest(XEvent *e) {
 void
 movemouse(const char *arg) {
 	int x1, y1, ocx, ocy, di, nx, ny;
-	unsigned int dui;
+	unsigned int dui, n;
 	Window dummy;
 	XEvent ev;
-	int bartop = (bpos == BarTop) ? bh : 0;
-	int barbot = (bpos == BarBot) ? bh : 0;
 	Client *c;
-#ifdef SNAPLOCALBORDERS
-	unsigned int s;
-#endif
+	Edge *xedges, *yedges;
 	Time lasttime = 0;
 	
 	if (!(c = sel))
@@ -1353,12 +2065,16 @@ movemouse(const char *arg) {
 			None, cursor[CurMove], CurrentTime) != GrabSuccess)
 		return;
 	c->ismax = False;
+	xedges = yedges = NULL;
+	n = getedges(c, &xedges, &yedges);
 	XQueryPointer(dpy, root, &dummy, &dummy, &x1, &y1, &di, &di, &dui);
 	for(;;) {
 		XMaskEvent(dpy, MOUSEMASK | ExposureMask | SubstructureRedirectMask, &ev);
 		switch (ev.type) {
 		case ButtonRelease:
 			XUngrabPointer(dpy, CurrentTime);
+			free(xedges);
+			free(yedges);
 			checkscreen(c);
 			return;
 		case ConfigureRequest:
@@ -1367,36 +2083,19 @@ movemouse(const char *arg) {
 			handler[ev.type](&ev);
  			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / REFRESH_HZ))
+			if ((ev.xmotion.time - lasttime) <= motioninterval(c))
 				continue;
 			lasttime = ev.xmotion.time;
 			XSync(dpy, False);
 			nx = ocx + (ev.xmotion.x - x1);
 			ny = ocy + (ev.xmotion.y - y1);
-			if (!c->isfloating)
+			if (!c->isfloating) {
 				togglefloating(NULL);
-#ifdef SNAPLOCALBORDERS
-			/* snap to ALL the borders! */
-			for(s = 0; s < screenmax; s++) {
-				if(abs(sx[s] - nx) < SNAP)
-					nx = sx[s];
-				else if(abs((sx[s] + sw[s]) - (nx + c->w + 2 * (int)c->border)) < SNAP)
-					nx = sx[s] + sw[s] - c->w - 2 * c->border;
-				if(abs((sy[s] + bartop) - ny) < SNAP)
-					ny = sy[s] + bartop;
-				else if(abs((sy[s] + sh[s] - barbot) - (ny + c->h + 2 * (int)c->border)) < SNAP)
-					ny = sy[s] + sh[s] - barbot - c->h - 2 * c->border;
+				/* the tiled clients have just been rearranged */
+				n = getedges(c, &xedges, &yedges);
 			}
-#else
-			if(abs(totalx - nx) < SNAP)
-				nx = totalx;
-			else if(abs((totalx + totalw) - (nx + c->w + 2 * (int)c->border)) < SNAP)
-				nx = totalx + totalw - c->w - 2 * c->border;
-			if(abs((totaly + bartop) - ny) < SNAP)
-				ny = totaly + bartop;
-			else if(abs((totaly + totalh - barbot) - (ny + c->h + 2 * (int)c->border)) < SNAP)
-				ny = totaly + totalh - barbot - c->h - 2 * c->border;
-#endif
+			nx = snapedges(xedges, n, nx, c->w + 2 * c->border, ny, ny + c->h + 2 * c->border);
+			ny = snapedges(yedges, n, ny, c->h + 2 * c->border, nx, nx + c->w + 2 * c->border);
 			resize(c, nx, ny, c->w, c->h, False);
 			break;
 		}
@@ -1417,12 +2116,149 @@ moveto(const char *arg) {
         arrange();
 }
 
+/* minimum time in ms between two updates in movemouse() and resizemouse():
+ * one frame of the screen the center of the client is on */
+unsigned int
+motioninterval(Client *c) {
+	unsigned int s;
+	int cx = c->x + c->w / 2, cy = c->y + c->h / 2;
+
+	for(s = 0; s < screenmax; s++)
+		if(sx[s] <= cx && cx < sx[s] + sw[s] && sy[s] <= cy && cy < sy[s] + sh[s])
+			return 1000 / refreshhz[s];
+	return 1000 / refreshhz[c->screen];
+}
+
+/* a glyph for text with its ink extents, still to be rendered */
+Glyph *
+newglyph(const char *text, unsigned int len) {
+	Glyph *g;
+	XRectangle ink, logical;
+	XCharStruct cs;
+	int d;
+
+	g = emallocz(sizeof(Glyph));
+	g->text = emallocz(MAX(len, 1));
+	memcpy(g->text, text, len);
+	g->len = len;
+	g->adv = textnw(dc, text, len);
+	if(dc->font.set) {
+		Xutf8TextExtents(dc->font.set, text, len, &ink, &logical);
+		g->x = ink.x;
+		g->w = ink.width;
+	}
+	else {
+		XTextExtents(dc->font.xfont, text, len, &d, &d, &d, &cs);
+		g->x = cs.lbearing;
+		g->w = MAX(cs.rbearing - cs.lbearing, 0);
+	}
+	g->mask = emallocz(MAX(g->w, 1) * dc->font.height);
+	return g;
+}
+
 Client *
 nexttiled(Client *c, unsigned int screen) {
 	for(; c && (c->isfloating || !ISVISIBLE(c) || c->screen != screen); c = c->next);
 	return c;
 }
 
+/* Takes c, with its border, out of the free rectangles of f. */
+void
+occupyclient(FreeRects *f, Client *c) {
+	Occupant *o;
+
+	if(f->nocc == f->occsize) {
+		f->occsize = f->occsize ? 2 * f->occsize : 16;
+		if(!(f->occ = realloc(f->occ, f->occsize * sizeof(Occupant))))
+			eprint("fatal: could not realloc() %u bytes\n", f->occsize * (unsigned int)sizeof(Occupant));
+	}
+	o = &f->occ[f->nocc++];
+	o->win = c->win;
+	o->r.x = c->x;
+	o->r.y = c->y;
+	o->r.w = c->w + 2 * c->border;
+	o->r.h = c->h + 2 * c->border;
+	occupyrect(f, o->r.x, o->r.y, o->r.w, o->r.h);
+}
+
+/* Marks x,y,w,h as occupied: every free rectangle that overlaps it is split
+ * into the (up to four) maximal rectangles around it, then rectangles that
+ * are contained in others are dropped. */
+void
+occupyrect(FreeRects *f, int x, int y, int w, int h) {
+	unsigned int i, n = 0;
+	Rect *r, *o;
+
+	o = emallocz((4 * f->n + 1) * sizeof(Rect));
+	for(i = 0; i < f->n; i++) {
+		r = &f->r[i];
+		if(x >= r->x + r->w || x + w <= r->x || y >= r->y + r->h || y + h <= r->y) {
+			o[n++] = *r;
+			continue;
+		}
+		if(x > r->x)
+			o[n++] = (Rect){ r->x, r->y, x - r->x, r->h };
+		if(x + w < r->x + r->w)
+			o[n++] = (Rect){ x + w, r->y, r->x + r->w - x - w, r->h };
+		if(y > r->y)
+			o[n++] = (Rect){ r->x, r->y, r->w, y - r->y };
+		if(y + h < r->y + r->h)
+			o[n++] = (Rect){ r->x, y + h, r->w, r->y + r->h - y - h };
+	}
+	keepmaximal(f, o, n);
+	free(o);
+}
+
+/* Moves a new floating client into the free area of its workspace that fits
+ * best (PlaceBestFit) or into the largest one (PlaceLargest). */
+void
+place(Client *c) {
+	FreeRects *f;
+	Rect *r, *best = NULL, *largest = NULL;
+	int w = c->w + 2 * c->border, h = c->h + 2 * c->border;
+	long fit, bestfit = LONG_MAX;
+	unsigned int i;
+
+	f = updatefreerects(c->screen, c->workspace - 1);
+	for(i = 0; i < f->n; i++) {
+		r = &f->r[i];
+		if(!largest || (long)r->w * r->h > (long)largest->w * largest->h)
+			largest = r;
+		if(r->w < w || r->h < h)
+			continue;
+		/* best short side fit, top-left most on ties */
+		fit = MIN(r->w - w, r->h - h);
+		if(fit < bestfit || (fit == bestfit && (r->y < best->y || (r->y == best->y && r->x < best->x)))) {
+			bestfit = fit;
+			best = r;
+		}
+	}
+	if(PLACEMENT == PlaceLargest || !best)
+		best = largest;
+	if(!best)
+		return;
+	c->x = best->x;
+	c->y = best->y;
+	if(PLACEMENT == PlaceLargest) {
+		if(best->w > w)
+			c->x += (best->w - w) / 2;
+		if(best->h > h)
+			c->y += (best->h - h) / 2;
+	}
+	/* a client that fits nowhere still stays in the work area */
+	if(c->x + w > wax[c->screen] + waw[c->screen])
+		c->x = wax[c->screen] + waw[c->screen] - w;
+	if(c->y + h > way[c->screen] + wah[c->screen])
+		c->y = way[c->screen] + wah[c->screen] - h;
+	if(c->x < wax[c->screen])
+		c->x = wax[c->screen];
+	if(c->y < way[c->screen])
+		c->y = way[c->screen];
+	/* the border depends on the position, the occupied area on the border */
+	setborderbyfloat(c, True);
+	occupyclient(f, c);
+}
+
 void
 popstack(const char *arg) {
 	Client *c;
@@ -1437,14 +2273,72 @@ popstack(const char *arg) {
 	arrange();
 }
 
+/* Resizes the banned clients on the neighbouring workspaces (the targets of
+ * viewrel()) to the geometry their layout will give them, so that switching
+ * there only has to move them back onscreen.  Runs when dwm is idle. */
+void
+prearrange(void) {
+	unsigned int s, i, n, ws, cur;
+	Bool mwf, zm;
+	Client *c;
+	Rect *onscreen;
+
+	prearranged = prearranging = True;
+	/* sticky clients are tiled along with the others, at the geometry they
+	 * will get, and keep their current one afterwards */
+	for(n = 0, c = clients; c; c = c->next, n++);
+	onscreen = emallocz((n + 1) * sizeof(Rect));
+	for(s = 0; s < screenmax; s++) {
+		if(workspaces[s] < 2)
+			continue;
+		cur = selws[s];
+		mwf = domwfact[s];
+		zm = dozoom[s];
+		for(i = 0; i < 2; i++) {
+			ws = i ? (cur + workspaces[s] - 2) % workspaces[s] + 1 : cur % workspaces[s] + 1;
+			if(i && workspaces[s] == 2)
+				break;
+			/* maximize() bans, focuses and restacks by itself */
+			if(layout[s][ws-1]->arrange == floating || layout[s][ws-1]->arrange == maximize)
+				continue;
+			/* the layouts only look at the clients ISVISIBLE() on selws */
+			for(n = 0, c = clients; c; c = c->next, n++)
+				onscreen[n] = (Rect){ c->x, c->y, c->w, c->h };
+			selws[s] = ws;
+			layout[s][ws-1]->arrange(s);
+			for(n = 0, c = clients; c; c = c->next, n++)
+				if(!c->isbanned) {
+					c->x = onscreen[n].x;
+					c->y = onscreen[n].y;
+					c->w = onscreen[n].w;
+					c->h = onscreen[n].h;
+				}
+		}
+		selws[s] = cur;
+		domwfact[s] = mwf;
+		dozoom[s] = zm;
+	}
+	free(onscreen);
+	prearranging = False;
+}
+
 void
 propertynotify(XEvent *e) {
 	Client *c;
 	Window trans;
+	unsigned int i;
+	char buf[sizeof segments[0].text];
 	XPropertyEvent *ev = &e->xproperty;
 
 	if((ev->window == root) && (ev->atom == XA_WM_NAME))
 		updatestatus();
+	else if(ev->window == root) {
+		for(i = 0; i < STATUSSEGMENTS; i++)
+			if(ev->atom == segatom[i]) {
+				gettextprop(root, segatom[i], buf, sizeof buf);
+				setsegment_(i, buf);
+			}
+	}
 	else if(ev->state == PropertyDelete)
 		return; /* ignore */
 	else if((c = getclient(ev->window))) {
@@ -1459,6 +2353,8 @@ propertynotify(XEvent *e) {
 				updatesizehints(c);
 				break;
 		}
+		if(ev->atom == wmatom[WMProtocols] || ev->atom == netatom[NetWMSyncRequestCounter])
+			updatesynccounter(c);
 		if(ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
 			updatetitle(c);
 			if(c == sel)
@@ -1487,59 +2383,19 @@ void
 resize(Client *c, int x, int y, int w, int h, Bool sizehints) {
 	XWindowChanges wc;
 
-	if(sizehints) {
-		/* set minimum possible */
-		if (w < 1)
-			w = 1;
-		if (h < 1)
-			h = 1;
-
-		/* temporarily remove base dimensions */
-		w -= c->basew;
-		h -= c->baseh;
-
-		/* adjust for aspect limits */
-		if (c->minay > 0 && c->maxay > 0 && c->minax > 0 && c->maxax > 0) {
-			if (w * c->maxay > h * c->maxax)
-				w = h * c->maxax / c->maxay;
-			else if (w * c->minay < h * c->minax)
-				h = w * c->minay / c->minax;
+	if(applysizehints(c, &x, &y, &w, &h, sizehints)) {
+		/* sticky clients are still onscreen, prearrange() restores them */
+		if(prearranging && !c->isbanned) {
+			c->x = x;
+			c->y = y;
+			c->w = w;
+			c->h = h;
+			return;
 		}
-
-		/* adjust for increment value */
-		if(c->incw)
-			w -= w % c->incw;
-		if(c->inch)
-			h -= h % c->inch;
-
-		/* restore base dimensions */
-		w += c->basew;
-		h += c->baseh;
-
-		if(c->minw > 0 && w < c->minw)
-			w = c->minw;
-		if(c->minh > 0 && h < c->minh)
-			h = c->minh;
-		if(c->maxw > 0 && w > c->maxw)
-			w = c->maxw;
-		if(c->maxh > 0 && h > c->maxh)
-			h = c->maxh;
-	}
-	if(w <= 0 || h <= 0)
-		return;
-	/* offscreen appearance fixes */
-	if(x > totalw)
-		x = totalw - w - 2 * c->border;
-	if(y > totalh)
-		y = totalh - h - 2 * c->border;
-	if(x + w + 2 * c->border < totalx)
-		x = totalx;
-	if(y + h + 2 * c->border < totaly)
-		y = totaly;
-	if(c->x != x || c->y != y || c->w != w || c->h != h) {
 		setborderbyfloat(c, False);
-		c->x = wc.x = x;
+		c->x = x;
 		c->y = wc.y = y;
+		wc.x = c->isbanned ? x + 2 * totalw : x; /* see ban() */
 		c->w = wc.width = w;
 		c->h = wc.height = h;
 		wc.border_width = c->border;
@@ -1549,13 +2405,32 @@ resize(Client *c, int x, int y, int w, int h, Bool sizehints) {
 	}
 }
 
+/* XIfEvent() predicate for resizemouse(): the events of XMaskEvent() with
+ * MOUSEMASK | ExposureMask | SubstructureRedirectMask plus XSync alarms */
+Bool
+resizeevent(Display *dsply, XEvent *ev, XPointer arg) {
+	switch(ev->type) {
+	case ButtonPress:
+	case ButtonRelease:
+	case MotionNotify:
+	case Expose:
+	case ConfigureRequest:
+	case CirculateRequest:
+	case MapRequest:
+		return True;
+	}
+	return syncextension && ev->type == syncevbase + XSyncAlarmNotify;
+}
+
 void
 resizemouse(const char *arg) {
 	int ocx, ocy;
-	int nw, nh;
+	int nw = 0, nh = 0;
 	XEvent ev;
 	Client *c;
-	Time lasttime = 0;
+	Time lasttime = 0, synctime = 0;
+	XSyncAlarm alarm = None;
+	Bool syncwait = False, pending = False;
 
 	if (!(c = sel))
 		return;
@@ -1566,11 +2441,32 @@ resizemouse(const char *arg) {
 			None, cursor[CurResize], CurrentTime) != GrabSuccess)
 		return;
 	c->ismax = False;
+	if(c->synccounter != None)
+		alarm = createsyncalarm(c);
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->border - 1, c->h + c->border - 1);
 	for(;;) {
-		XMaskEvent(dpy, MOUSEMASK | ExposureMask | SubstructureRedirectMask , &ev);
+		XIfEvent(dpy, &ev, resizeevent, NULL);
+		if(syncextension && ev.type == syncevbase + XSyncAlarmNotify) {
+			if(((XSyncAlarmNotifyEvent *)&ev)->alarm != alarm)
+				continue;
+			/* client has caught up, send what piled up in the meantime */
+			syncwait = False;
+			if(!pending)
+				continue;
+			lasttime = synctime = ((XSyncAlarmNotifyEvent *)&ev)->time;
+			syncwait = resizesync(c, alarm, lasttime, nw, nh);
+			pending = False;
+			continue;
+		}
 		switch(ev.type) {
 		case ButtonRelease:
+			if(pending) {
+				if (!c->isfloating)
+					togglefloating(NULL);
+				resize(c, c->x, c->y, nw, nh, True);
+			}
+			if(alarm != None)
+				XSyncDestroyAlarm(dpy, alarm);
 			XWarpPointer(dpy, None, c->win, 0, 0, 0, 0,
 					c->w + c->border - 1, c->h + c->border - 1);
 			XUngrabPointer(dpy, CurrentTime);
@@ -1583,22 +2479,44 @@ resizemouse(const char *arg) {
 			handler[ev.type](&ev);
 			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / REFRESH_HZ))
+			if((nw = ev.xmotion.x - ocx - 2 * c->border + 1) <= 0)
+				nw = 1;
+			if((nh = ev.xmotion.y - ocy - 2 * c->border + 1) <= 0)
+				nh = 1;
+			pending = True;
+			if ((ev.xmotion.time - lasttime) <= motioninterval(c))
+				continue;
+			/* wait for the client to repaint, unless it takes too long */
+			if (syncwait && (ev.xmotion.time - synctime) <= SYNCTIMEOUT)
 				continue;
 			lasttime = ev.xmotion.time;
 			XSync(dpy, False);
 			if (!c->isfloating)
 				togglefloating(NULL);
-			if((nw = ev.xmotion.x - ocx - 2 * c->border + 1) <= 0)
-				nw = 1;
-			if((nh = ev.xmotion.y - ocy - 2 * c->border + 1) <= 0)
-				nh = 1;
-			resize(c, c->x, c->y, nw, nh, True);
+			synctime = lasttime;
+			syncwait = resizesync(c, alarm, lasttime, nw, nh);
+			pending = False;
 			break;
 		}
 	}
 }
 
+/* resizes c, first sending a sync request if it has a counter and its
+ * geometry really changes, as it would never answer one otherwise;
+ * returns whether it was sent */
+Bool
+resizesync(Client *c, XSyncAlarm alarm, Time time, int w, int h) {
+	int nx = c->x, ny = c->y, nw = w, nh = h;
+	Bool sent = False;
+
+	if(alarm != None && applysizehints(c, &nx, &ny, &nw, &nh, True)) {
+		syncrequest(c, alarm, time);
+		sent = True;
+	}
+	resize(c, c->x, c->y, w, h, True);
+	return sent;
+}
+
 void
 restack(void) {
 	Client *c;
@@ -1628,14 +2546,176 @@ restack(void) {
 	while(XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
+/* built-in status text: clock and load average */
+void
+readbuiltinstatus(int fd) {
+	uint64_t expirations;
+	char buf[64], *p;
+	time_t t;
+	ssize_t n;
+	unsigned int i;
+
+	if(read(fd, &expirations, sizeof expirations) != sizeof expirations)
+		return;
+	t = time(NULL);
+	if(!strftime(stext, sizeof stext - sizeof buf, BUILTINSTATUSTIME, localtime(&t)))
+		stext[0] = '\0';
+	/* first three fields of /proc/loadavg */
+	if(loadavgfd >= 0 && (n = pread(loadavgfd, buf, sizeof buf - 1, 0)) > 0) {
+		buf[n] = '\0';
+		for(i = 0, p = buf; *p && !(*p == ' ' && ++i == 3); p++);
+		*p = '\0';
+		strcat(stext, " ");
+		strcat(stext, buf);
+	}
+	statuschanged();
+}
+
+/* SIGCHLD and SIGUSR1 are blocked and delivered here instead of to a
+ * signal handler, so they are handled synchronously in the event loop */
+void
+readsignals(int fd) {
+	struct signalfd_siginfo si;
+
+	while(read(fd, &si, sizeof si) == sizeof si)
+		switch(si.ssi_signo) {
+		case SIGCHLD:
+			sigchld();
+			break;
+		case SIGUSR1:
+			sigusr1();
+			break;
+		}
+}
+
+void
+readstatustimer(int fd) {
+	uint64_t expirations;
+	unsigned int i;
+
+	if(read(fd, &expirations, sizeof expirations) != sizeof expirations)
+		return;
+	/* status text or some segments have timed out */
+	if(!nsegments) {
+		stextdirty = True;
+		drawbar();
+	}
+	else
+		for(i = 0; i < STATUSSEGMENTS; i++)
+			if(segments[i].w && !segments[i].isstale && isstale(segments[i].updated)) {
+				segments[i].isstale = True;
+				drawsegment(i);
+			}
+	updatestatustimer();
+}
+
+/* the status text is the same on all screens, so it is drawn only once */
+/* draws n glyphs side by side into one bitmap and reads it back from the
+ * server in a single round trip */
+void
+renderglyphs(Glyph **g, unsigned int n) {
+	GC gc;
+	Pixmap pm;
+	XImage *img;
+	unsigned int i, x, y, w, ox;
+
+	for(w = i = 0; i < n; i++)
+		w += g[i]->w;
+	if(!w)
+		return;
+	pm = XCreatePixmap(dpy, root, w, dc->font.height, 1);
+	gc = XCreateGC(dpy, pm, 0, NULL);
+	XFillRectangle(dpy, pm, gc, 0, 0, w, dc->font.height);
+	XSetForeground(dpy, gc, 1);
+	if(!dc->font.set)
+		XSetFont(dpy, gc, dc->font.xfont->fid);
+	for(ox = i = 0; i < n; ox += g[i++]->w)
+		if(dc->font.set)
+			Xutf8DrawString(dpy, pm, dc->font.set, gc, ox - g[i]->x, dc->font.ascent, g[i]->text, g[i]->len);
+		else
+			XDrawString(dpy, pm, gc, ox - g[i]->x, dc->font.ascent, g[i]->text, g[i]->len);
+	if((img = XGetImage(dpy, pm, 0, 0, w, dc->font.height, 1, ZPixmap))) {
+		for(ox = i = 0; i < n; ox += g[i++]->w)
+			for(y = 0; y < dc->font.height; y++)
+				for(x = 0; x < g[i]->w; x++)
+					g[i]->mask[y * g[i]->w + x] = XGetPixel(img, ox + x, y) != 0;
+		XDestroyImage(img);
+	}
+	XFreeGC(dpy, gc);
+	XFreePixmap(dpy, pm);
+}
+
+void
+renderstatus(unsigned int w) {
+	Drawable d = dc->canvas;
+
+	if(shmimg)
+		stextpmw = w;
+	else if(w != stextpmw || !stextpm) {
+		if(stextpm)
+			XFreePixmap(dpy, stextpm);
+		stextpm = XCreatePixmap(dpy, root, MAX(w, 1), bh, DefaultDepth(dpy, screen));
+		stextpmw = w;
+	}
+	dc->canvas = stextpm;
+	dc->x = 0;
+	dc->y = shmimg ? screenmax * bh : 0;
+	dc->w = w;
+	drawstatus();
+	flushdc(dc);
+	dc->canvas = d;
+	dc->y = 0;
+	stextdirty = False;
+}
+
 void
 run(void) {
 	XEvent ev;
+	struct pollfd pfd[MAXWATCHES + 1];
+	unsigned int i, j, npfd;
+
 	/* main event loop*/
 	XSync(dpy, False);
-	while(running && !XNextEvent(dpy, &ev)) {
-		if(handler[ev.type])
-			(handler[ev.type])(&ev); /* call handler */
+	while(running) {
+		while(running && XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			/* extension events (eg. late XSync alarms) have no handler */
+			if(ev.type < LASTEvent && handler[ev.type])
+				(handler[ev.type])(&ev); /* call handler */
+			else if(randrextension && ev.type == randrevbase + RRScreenChangeNotify) {
+				XRRUpdateConfiguration(&ev);
+				updaterefreshrates();
+			}
+		}
+		if(!running)
+			break;
+#ifdef PREARRANGE
+		if(!prearranged) {
+			prearrange();
+			continue;
+		}
+#endif
+		/* sleep until X, a timer, a signal or another watch wakes us up */
+		pfd[0].fd = ConnectionNumber(dpy);
+		pfd[0].events = POLLIN;
+		for(i = 0; i < nwatches; i++) {
+			pfd[i+1].fd = watches[i].fd;
+			pfd[i+1].events = POLLIN;
+		}
+		npfd = nwatches + 1;
+		if(poll(pfd, npfd, -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			eprint("dwm: poll failed: %s\n", strerror(errno));
+		}
+		/* a callback may remove watches, so look them up again */
+		for(i = 1; i < npfd; i++)
+			if(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+				for(j = 0; j < nwatches; j++)
+					if(watches[j].fd == pfd[i].fd) {
+						watches[j].func(pfd[i].fd);
+						break;
+					}
 	}
 }
 
@@ -1690,6 +2770,31 @@ setborderbyfloat(Client *c, Bool configurewindow) {
 	configure(c);
 }
 
+/* the built-in status is replaced as soon as someone else sets the root window name */
+void
+setbuiltinstatus(Bool enable) {
+	struct itimerspec its = { { BUILTINSTATUSINTERVAL, 0 }, { 0, 0 } };
+
+	if(builtinstatusfd < 0)
+		return;
+	if(enable) {
+		/* tick on full seconds */
+		clock_gettime(CLOCK_REALTIME, &its.it_value);
+		its.it_value.tv_sec++;
+		its.it_value.tv_nsec = 0;
+		timerfd_settime(builtinstatusfd, TFD_TIMER_ABSTIME, &its, NULL);
+	}
+	else {
+		timerfd_settime(builtinstatusfd, 0, &its, NULL);
+		delwatch(builtinstatusfd);
+		close(builtinstatusfd);
+		builtinstatusfd = -1;
+		if(loadavgfd >= 0)
+			close(loadavgfd);
+		loadavgfd = -1;
+	}
+}
+
 void
 setclientstate(Client *c, long state) {
 	long data[] = {state, None};
@@ -1766,16 +2871,67 @@ setmwfact(const char *arg) {
 	arrange();
 }
 
+void
+setsegment(const char *arg) {
+	char *text;
+	unsigned int i;
+
+	if(!arg)
+		return;
+	i = strtoul(arg, &text, 10);
+	if(text == arg || i >= STATUSSEGMENTS)
+		return;
+	setsegment_(i, *text == ' ' ? text + 1 : text);
+}
+
+/* only the changed segment is redrawn, unless its width changes */
+void
+setsegment_(unsigned int i, const char *text) {
+	Segment *sg = &segments[i];
+	unsigned int w, olds = nsegments;
+	Bool wasstale = sg->isstale;
+
+	setbuiltinstatus(False);
+	sg->updated = time(NULL);
+	sg->isstale = False;
+	if(!strcmp(sg->text, text) && sg->w) {
+		if(wasstale)
+			drawsegment(i);
+	}
+	else {
+		strncpy(sg->text, text, sizeof sg->text - 1);
+		w = *text ? textw(dc, sg->text) : 0;
+		nsegments += (w && !sg->w) - (!w && sg->w);
+		if(w == sg->w && olds)
+			drawsegment(i);
+		else {
+			sg->w = w;
+			stextdirty = True;
+			drawbar();
+		}
+		ipcevent("segment %u %s", i, sg->text);
+	}
+	updatestatustimer();
+}
+
 void
 setup(void) {
-	int d;
+	char buf[32];
+	int d, major, minor;
 	unsigned int i, j, mask, s;
 	Window w;
 	XModifierKeymap *modmap;
 	XSetWindowAttributes wa;
 
-	/* clean up any zombies immediately */
-	sigchld(0);
+	/* handle signals in run(), clean up any zombies immediately */
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, SIGCHLD);
+	sigaddset(&sigmask, SIGUSR1);
+	if(sigprocmask(SIG_BLOCK, &sigmask, &origsigmask) < 0
+	|| (d = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+		eprint("Can't set up signal handling: %s\n", strerror(errno));
+	addwatch(d, readsignals);
+	sigchld();
 
 	/* init atoms */
 	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
@@ -1787,6 +2943,8 @@ setup(void) {
 	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
 	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
 	netatom[NetWMWindowTypeSplash] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_SPLASH", False);
+	netatom[NetWMSyncRequest] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST", False);
+	netatom[NetWMSyncRequestCounter] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST_COUNTER", False);
 	XChangeProperty(dpy, root, netatom[NetSupported], XA_ATOM, 32,
 			PropModeReplace, (unsigned char *) netatom, NetLast);
 	dwmatom[dwmScreen] = XInternAtom(dpy, "DWM_MITCH_SCREEN", False);
@@ -1794,6 +2952,10 @@ setup(void) {
 	dwmatom[dwmFloating] = XInternAtom(dpy, "DWM_MITCH_FLOATING", False);
 	dwmatom[dwmSticky] = XInternAtom(dpy, "DWM_MITCH_STICKY", False);
 	dwmatom[dwmLayout] = XInternAtom(dpy, "DWM_MITCH_LAYOUT", False);
+	for(i = 0; i < STATUSSEGMENTS; i++) {
+		snprintf(buf, sizeof buf, "DWM_MITCH_STATUS%u", i);
+		segatom[i] = XInternAtom(dpy, buf, False);
+	}
 
 	/* hack: initialize these atoms but don't advertize them */
 	netatom[NetWMFullscreen] = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
@@ -1814,6 +2976,19 @@ setup(void) {
 		}
 	XFreeModifiermap(modmap);
 
+	/* init XSync for _NET_WM_SYNC_REQUEST */
+	syncextension = XSyncQueryExtension(dpy, &syncevbase, &syncerrbase)
+		&& XSyncInitialize(dpy, &d, &d);
+
+	/* init RandR for refresh rates, mode changes don't always resize the root window;
+	 * XRRGetScreenResourcesCurrent() needs RandR 1.3 */
+	if((randrextension = XRRQueryExtension(dpy, &randrevbase, &randrerrbase)
+	&& XRRQueryVersion(dpy, &major, &minor) && (major > 1 || (major == 1 && minor >= 3))))
+		XRRSelectInput(dpy, root, RRScreenChangeNotifyMask);
+#ifdef SHMBAR
+	shmextension = XShmQueryExtension(dpy);
+#endif
+
 	/* select for events */
 	wa.event_mask = SubstructureRedirectMask | SubstructureNotifyMask
 		| EnterWindowMask | LeaveWindowMask | StructureNotifyMask
@@ -1838,25 +3013,27 @@ setup(void) {
 	}
 
 	/* init appearance */
-	dc.norm[ColBorder] = getcolor(NORMBORDERCOLOR);
-	dc.norm[ColBG] = getcolor(NORMBGCOLOR);
-	dc.norm[ColFG] = getcolor(NORMFGCOLOR);
-	dc.norm[ColEdge] = getcolor(EDGECOLOR);
-	dc.sel[ColBorder] = getcolor(SELBORDERCOLOR);
-	dc.sel[ColBG] = getcolor(SELBGCOLOR);
-	dc.sel[ColFG] = getcolor(SELFGCOLOR);
-	dc.sel[ColEdge] = getcolor(EDGECOLOR);
-	dc.err[ColBorder] = getcolor(ERRBORDERCOLOR);
-	dc.err[ColBG] = getcolor(ERRBGCOLOR);
-	dc.err[ColFG] = getcolor(ERRFGCOLOR);
-	dc.err[ColEdge] = getcolor(EDGECOLOR);
-	initfont(FONT);
-	dc.h = bh = dc.font.height + 2;
+	normcol[ColBorder] = getcolor(dc, NORMBORDERCOLOR);
+	normcol[ColBG] = getcolor(dc, NORMBGCOLOR);
+	normcol[ColFG] = getcolor(dc, NORMFGCOLOR);
+	normcol[ColEdge] = getcolor(dc, EDGECOLOR);
+	selcol[ColBorder] = getcolor(dc, SELBORDERCOLOR);
+	selcol[ColBG] = getcolor(dc, SELBGCOLOR);
+	selcol[ColFG] = getcolor(dc, SELFGCOLOR);
+	selcol[ColEdge] = getcolor(dc, EDGECOLOR);
+	errcol[ColBorder] = getcolor(dc, ERRBORDERCOLOR);
+	errcol[ColBG] = getcolor(dc, ERRBGCOLOR);
+	errcol[ColFG] = getcolor(dc, ERRFGCOLOR);
+	errcol[ColEdge] = getcolor(dc, EDGECOLOR);
+	initfont(dc, FONT);
+	dc->h = bh = dc->font.height + 2;
 
 	/* init geometry */
 	/* init to simple width, expand and update later if xinerama is detected */
-	dc.drawable = XCreatePixmap(dpy, root, DisplayWidth(dpy, screen), bh, DefaultDepth(dpy, screen)); 
+	resizedc(dc, DisplayWidth(dpy, screen), bh);
 	updatexinerama();
+	updaterefreshrates();
+	updateshm();
 
 	/* init layouts */
 	for(s = 0; s < MAXXINERAMASCREENS; s++)
@@ -1865,7 +3042,7 @@ setup(void) {
 			layout[s][i] = &layouts[0];
 		}
 	for(blw = i = 0; i < LENGTH(layouts); i++) {
-		j = textw(layouts[i].symbol);
+		j = textw(dc, layouts[i].symbol);
 		if(j > blw)
 			blw = j;
 	}
@@ -1874,37 +3051,109 @@ setup(void) {
 	createbarwins();
 	strcpy(stext, "dwm-"VERSION);
 	stextupdated = time(NULL);
-	dc.gc = XCreateGC(dpy, root, 0, 0);
-	XSetLineAttributes(dpy, dc.gc, 1, LineSolid, CapButt, JoinMiter);
-	if(!dc.font.set)
-		XSetFont(dpy, dc.gc, dc.font.xfont->fid);
 	for(s = 0; s < MAXXINERAMASCREENS; s++)
 		updatewstext(s);
 
 	/* multihead support */
 	selscreen = XQueryPointer(dpy, root, &w, &w, &d, &d, &d, &d, &mask);
 
-	/* restart support */
-	if (signal(SIGUSR1, sigusr1) == SIG_ERR) 
-		eprint("Can't bind to signal USR1\n");
+	/* status bar timeout */
+	if(STATUSBARTIMEOUT > 0) {
+		if((statustimerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+			eprint("Can't create status bar timer: %s\n", strerror(errno));
+		addwatch(statustimerfd, readstatustimer);
+		updatestatustimer();
+	}
+
+#ifdef IPC
+	/* control socket */
+	ipcsetup();
+#endif
 
+#ifdef BUILTINSTATUS
+	/* status text until ~/.dwm-status or similar sets the root window name */
+	if((builtinstatusfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) >= 0) {
+		loadavgfd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+		addwatch(builtinstatusfd, readbuiltinstatus);
+		setbuiltinstatus(True);
+	}
+#endif
 }
 
+/* copies a rectangle within shmimg */
 void
-sigchld(int unused) {
-	if(signal(SIGCHLD, sigchld) == SIG_ERR) {
-		perror("Can't install SIGCHLD handler");
-		exit(EXIT_FAILURE);
-	}
+shmcopy(int x1, int y1, int x2, int y2, unsigned int w, unsigned int h) {
+	unsigned int bpp = shmimg->bits_per_pixel / 8, y;
+
+	if(x1 < 0 || x2 < 0 || y1 < 0 || y2 < 0)
+		return;
+	w = MIN(w, (unsigned int)shmimg->width - MAX(x1, x2));
+	h = MIN(h, (unsigned int)shmimg->height - MAX(y1, y2));
+	for(y = 0; y < h; y++)
+		memmove(shmimg->data + (y2 + y) * shmimg->bytes_per_line + x2 * bpp,
+			shmimg->data + (y1 + y) * shmimg->bytes_per_line + x1 * bpp, w * bpp);
+}
+
+/* sets one pixel, copies it along the row and the row downwards */
+void
+shmfill(int x, int y, unsigned int w, unsigned int h, unsigned long color) {
+	unsigned int bpp = shmimg->bits_per_pixel / 8, n, done;
+	int x2 = MIN(x + (int)w, shmimg->width), y2 = MIN(y + (int)h, shmimg->height), j;
+	char *row;
+
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	if(x >= x2 || y >= y2)
+		return;
+	XPutPixel(shmimg, x, y, color);
+	row = shmimg->data + y * shmimg->bytes_per_line + x * bpp;
+	n = (x2 - x) * bpp;
+	for(done = bpp; done < n; done *= 2)
+		memcpy(row + done, row, MIN(done, n - done));
+	for(j = y + 1; j < y2; j++)
+		memcpy(row + (j - y) * shmimg->bytes_per_line, row, n);
+}
+
+void
+sigchld(void) {
 	while(0 < waitpid(-1, NULL, WNOHANG));
 }
 
 void
-sigusr1(int unused) {
+sigusr1(void) {
 	quit(NULL);
 	reload = True;
 }
 
+/* Returns pos moved so that pos or pos + size lies on the nearest edge within
+ * SNAP pixels that overlaps from..to, or pos if there is none. */
+int
+snapedges(Edge *e, unsigned int n, int pos, int size, int from, int to) {
+	unsigned int lo, hi, mid, i;
+	int d, best = SNAP, res = pos;
+	int border[2];
+
+	border[0] = pos;
+	border[1] = pos + size;
+	for(i = 0; i < 2; i++) {
+		/* first edge that is not too far to the left or top */
+		for(lo = 0, hi = n; lo < hi;) {
+			mid = (lo + hi) / 2;
+			if(e[mid].pos <= border[i] - SNAP)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for(; lo < n && e[lo].pos < border[i] + SNAP; lo++)
+			if((d = abs(e[lo].pos - border[i])) < best
+			&& e[lo].from <= to && from <= e[lo].to) {
+				best = d;
+				res = e[lo].pos - (border[i] - pos);
+			}
+	}
+	return res;
+}
+
 void
 spawn(const char *arg) {
 	static char *shell = NULL;
@@ -1917,6 +3166,7 @@ spawn(const char *arg) {
 	if(fork() == 0) {
 		if(dpy)
 			close(ConnectionNumber(dpy));
+		sigprocmask(SIG_SETMASK, &origsigmask, NULL);
 		setsid();
 		execl(shell, shell, "-c", arg, (char *)NULL);
 		fprintf(stderr, "dwm: execl '%s -c %s'", shell, arg);
@@ -1925,6 +3175,37 @@ spawn(const char *arg) {
 	}
 }
 
+void
+statuschanged(void) {
+	stextupdated = time(NULL);
+	stextdirty = True;
+	updatestatustimer();
+	drawbar();
+	ipcevent("status %s", stext);
+}
+
+/* colors next to the window title */
+unsigned long *
+statuscolor(void) {
+	unsigned int i;
+
+	for(i = 0; nsegments && i < STATUSSEGMENTS; i++)
+		if(segments[i].w)
+			return segments[i].isstale ? errcol : normcol;
+	return isstale(stextupdated) ? errcol : normcol;
+}
+
+unsigned int
+statuswidth(void) {
+	unsigned int i, w = 0;
+
+	if(!nsegments)
+		return textw(dc, stext);
+	for(i = 0; i < STATUSSEGMENTS; i++)
+		w += segments[i].w;
+	return w;
+}
+
 void
 swapscreen(const char *arg) {
 	Client *c;
@@ -1957,20 +3238,30 @@ swapscreen(const char *arg) {
 	arrange();
 }
 
-unsigned int
-textnw(const char *text, unsigned int len) {
-	XRectangle r;
+/* _NET_WM_SYNC_REQUEST: ask the client to raise its counter once it has
+ * handled the next ConfigureNotify, and rearm the alarm to wait for that */
+void
+syncrequest(Client *c, XSyncAlarm alarm, Time time) {
+	XEvent ev;
+	XSyncValue one;
+	XSyncAlarmAttributes aa;
+	Bool overflow;
 
-	if(dc.font.set) {
-		Xutf8TextExtents(dc.font.set, text, len, NULL, &r);
-		return r.width;
-	}
-	return XTextWidth(dc.font.xfont, text, len);
-}
+	XSyncIntToValue(&one, 1);
+	XSyncValueAdd(&c->syncvalue, c->syncvalue, one, &overflow);
+	aa.trigger.wait_value = c->syncvalue;
+	XSyncChangeAlarm(dpy, alarm, XSyncCAValue, &aa);
 
-unsigned int
-textw(const char *text) {
-	return textnw(text, strlen(text)) + dc.font.height;
+	ev.type = ClientMessage;
+	ev.xclient.window = c->win;
+	ev.xclient.message_type = wmatom[WMProtocols];
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = netatom[NetWMSyncRequest];
+	ev.xclient.data.l[1] = time;
+	ev.xclient.data.l[2] = XSyncValueLow32(c->syncvalue);
+	ev.xclient.data.l[3] = XSyncValueHigh32(c->syncvalue);
+	ev.xclient.data.l[4] = 0;
+	XSendEvent(dpy, c->win, False, NoEventMask, &ev);
 }
 
 void
@@ -2197,6 +3488,147 @@ updatebarpos(void) {
 	while(XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
+void
+updaterefreshrates(void) {
+	XRRScreenResources *res = NULL;
+	XRRCrtcInfo *crtc;
+	XRRModeInfo *mode;
+	unsigned int s, hz;
+	double vtotal;
+	int i, j;
+
+	for(s = 0; s < MAXXINERAMASCREENS; s++)
+		refreshhz[s] = 0;
+	if(randrextension)
+		res = XRRGetScreenResourcesCurrent(dpy, root);
+	for(i = 0; res && i < res->ncrtc; i++) {
+		if(!(crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[i])))
+			continue;
+		for(j = 0, mode = NULL; crtc->mode != None && j < res->nmode; j++)
+			if(res->modes[j].id == crtc->mode)
+				mode = &res->modes[j];
+		if(mode && mode->hTotal && mode->vTotal) {
+			vtotal = mode->vTotal;
+			if(mode->modeFlags & RR_DoubleScan)
+				vtotal *= 2;
+			if(mode->modeFlags & RR_Interlace)
+				vtotal /= 2;
+			hz = mode->dotClock / (mode->hTotal * vtotal) + 0.5;
+			/* every screen inside this CRTC, cloned outputs take the faster one */
+			for(s = 0; s < screenmax; s++)
+				if(crtc->x <= sx[s] && sx[s] < crtc->x + (int)crtc->width
+				&& crtc->y <= sy[s] && sy[s] < crtc->y + (int)crtc->height
+				&& hz > refreshhz[s])
+					refreshhz[s] = hz;
+		}
+		XRRFreeCrtcInfo(crtc);
+	}
+	if(res)
+		XRRFreeScreenResources(res);
+	for(s = 0; s < MAXXINERAMASCREENS; s++)
+		if(refreshhz[s] == 0)
+			refreshhz[s] = REFRESH_HZ;
+		else if(MAXREFRESH_HZ > 0 && refreshhz[s] > MAXREFRESH_HZ)
+			refreshhz[s] = MAXREFRESH_HZ;
+}
+
+/* Returns the free rectangle index of workspace ws on screen s, brought up
+ * to date with the floating clients: only those that were added, removed,
+ * moved or resized since the last call change the rectangles.  A new work
+ * area starts the index over. */
+FreeRects *
+updatefreerects(unsigned int s, unsigned int ws) {
+	FreeRects *f = &freerects[s][ws];
+	Client *c;
+	Rect r;
+	unsigned int i;
+	Bool isfloat = (layout[s][ws]->arrange == floating);
+
+	if(!f->isvalid
+	|| f->area.x != wax[s] || f->area.y != way[s] || f->area.w != waw[s] || f->area.h != wah[s]) {
+		f->area.x = wax[s];
+		f->area.y = way[s];
+		f->area.w = waw[s];
+		f->area.h = wah[s];
+		f->isvalid = True;
+		if(!f->size) {
+			f->size = 16;
+			f->r = emallocz(f->size * sizeof(Rect));
+		}
+		f->r[0] = f->area;
+		f->n = 1;
+		f->nocc = 0;
+	}
+	/* clients that are gone or changed give their old area back */
+	for(i = 0; i < f->nocc;) {
+		for(c = clients; c; c = c->next)
+			if(c->win == f->occ[i].win)
+				break;
+		if(c && c->screen == s && (c->workspace == ws + 1 || (c->workspace && c->issticky))
+		&& (c->isfloating || isfloat)
+		&& c->x == f->occ[i].r.x && c->y == f->occ[i].r.y
+		&& c->w + 2 * c->border == f->occ[i].r.w && c->h + 2 * c->border == f->occ[i].r.h) {
+			i++;
+			continue;
+		}
+		r = f->occ[i].r;
+		f->occ[i] = f->occ[--f->nocc];
+		freerect(f, &r);
+	}
+	/* and take their new one, as do new clients */
+	for(c = clients; c; c = c->next)
+		if(c->screen == s && (c->workspace == ws + 1 || (c->workspace && c->issticky))
+		&& (c->isfloating || isfloat)) {
+			for(i = 0; i < f->nocc && f->occ[i].win != c->win; i++);
+			if(i == f->nocc)
+				occupyclient(f, c);
+		}
+	return f;
+}
+
+/* (re)creates the MIT-SHM bar canvas for the current screen sizes; stays
+ * with the pixmap if the server cannot attach the segment (remote X) */
+void
+updateshm(void) {
+	freeshm();
+	if(!shmextension)
+		return;
+	shmimg = XShmCreateImage(dpy, DefaultVisual(dpy, screen), DefaultDepth(dpy, screen),
+				 ZPixmap, NULL, &shminfo, totalw, (screenmax + 1) * bh);
+	if(!shmimg)
+		return;
+	if(shmimg->bits_per_pixel % 8
+	|| (shminfo.shmid = shmget(IPC_PRIVATE, shmimg->bytes_per_line * shmimg->height, IPC_CREAT | 0600)) < 0) {
+		XDestroyImage(shmimg);
+		shmimg = NULL;
+		return;
+	}
+	shminfo.shmaddr = shmimg->data = shmat(shminfo.shmid, NULL, 0);
+	shminfo.readOnly = False;
+	shmerror = (shminfo.shmaddr == (char *)-1);
+	if(!shmerror) {
+		XSync(dpy, False);
+		XSetErrorHandler(xerrorshm);
+		XShmAttach(dpy, &shminfo);
+		XSync(dpy, False);
+		XSetErrorHandler(xerror);
+	}
+	/* freed when both sides have detached; only now, as not every system
+	 * allows attaching a segment marked for removal */
+	shmctl(shminfo.shmid, IPC_RMID, NULL);
+	if(shmerror) {
+		if(shminfo.shmaddr != (char *)-1)
+			shmdt(shminfo.shmaddr);
+		shmimg->data = NULL;
+		XDestroyImage(shmimg);
+		shmimg = NULL;
+		shmextension = False;
+	}
+	else
+		loadglyphs();
+	stextdirty = True;
+}
+
 void
 updatesizehints(Client *c) {
 	long msize;
@@ -2253,8 +3685,56 @@ void
 updatestatus(void) {
 	if(!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
 		strcpy(stext, "dwm-"VERSION);
-	stextupdated = time(NULL);
-	drawbar();
+	setbuiltinstatus(False);
+	statuschanged();
+}
+
+/* rearm the timer to redraw the bar when the status text or the next
+ * segment times out */
+void
+updatestatustimer(void) {
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+	time_t now = time(NULL), next = 0;
+	unsigned int i;
+
+	if(statustimerfd < 0)
+		return;
+	if(!nsegments)
+		next = stextupdated + STATUSBARTIMEOUT + 1;
+	for(i = 0; nsegments && i < STATUSSEGMENTS; i++)
+		if(segments[i].w && !segments[i].isstale
+		&& (!next || segments[i].updated + STATUSBARTIMEOUT + 1 < next))
+			next = segments[i].updated + STATUSBARTIMEOUT + 1;
+	if(next)
+		its.it_value.tv_sec = next > now ? next - now : 1;
+	timerfd_settime(statustimerfd, 0, &its, NULL);
+}
+
+void
+updatesynccounter(Client *c) {
+	int i, n, format;
+	unsigned long nitems, extra;
+	unsigned char *p = NULL;
+	Atom *protocols, real;
+	Bool hassync = False;
+
+	c->synccounter = None;
+	if(!syncextension)
+		return;
+	if(XGetWMProtocols(dpy, c->win, &protocols, &n)) {
+		for(i = 0; !hassync && i < n; i++)
+			if(protocols[i] == netatom[NetWMSyncRequest])
+				hassync = True;
+		XFree(protocols);
+	}
+	if(!hassync)
+		return;
+	if(XGetWindowProperty(dpy, c->win, netatom[NetWMSyncRequestCounter], 0L, 1L, False, XA_CARDINAL,
+			&real, &format, &nitems, &extra, &p) == Success && p) {
+		if(nitems)
+			c->synccounter = *(unsigned long *)p;
+		XFree(p);
+	}
 }
 
 void
@@ -2266,7 +3746,7 @@ updatetitle(Client *c) {
 void
 updatewstext(int screen) {
 	snprintf(wstext[screen], MAXWSTEXTWIDTH, "%d/%d", selws[screen], workspaces[screen]);
-	wstextwidth[screen] = textw(wstext[screen]);
+	wstextwidth[screen] = textw(dc, wstext[screen]);
 }
 
 void
@@ -2287,7 +3767,6 @@ updatexinerama(void) {
 		return;
 	}
 	
-	XFreePixmap(dpy, dc.drawable);
         xinescreens = XineramaQueryScreens(dpy, &xinescreencount);
 	screenmax = 0;
 	totalw = totalh = 0;
@@ -2341,7 +3820,7 @@ updatexinerama(void) {
 		if(c->screen >= screenmax)
 			c->workspace = 0;
 	XFree(xinescreens);
-	dc.drawable = XCreatePixmap(dpy, root, totalw, bh, DefaultDepth(dpy, screen)); 
+	resizedc(dc, totalw, bh);
 }
 
 void
@@ -2417,22 +3896,20 @@ warpmouse_(unsigned int source, unsigned int target) {
 
 void
 warpmouserel(const char *arg) {
-        int i, target;
+        int target;
+	long l;
 	unsigned int source;
 
 	if (screenmax == 1)
 	        return;
 
-	i = arg ? atoi(arg) : 0;
-	if (i == 0)
+	/* arg may come from the socket: strtol() saturates, atoi() overflows */
+	l = arg ? strtol(arg, NULL, 10) : 0;
+	if (l == 0)
                 return;
 
-	target = source = whichscreen();
-	target += i;
-	while (target < 0)
-		target += screenmax;
-	while (target >= screenmax)
-		target -= screenmax;
+	source = whichscreen();
+	target = ((int)source + (int)(l % (long)screenmax) + (int)screenmax) % (int)screenmax;
 
 	warpmouse_(source, target);
 }
@@ -2526,7 +4003,9 @@ xerror(Display *dpy, XErrorEvent *ee) {
 	|| (ee->request_code == X_ConfigureWindow && ee->error_code == BadMatch)
 	|| (ee->request_code == X_ChangeWindowAttributes && ee->error_code == BadMatch)
 	|| (ee->request_code == X_GrabKey && ee->error_code == BadAccess)
-	|| (ee->request_code == X_CopyArea && ee->error_code == BadDrawable))
+	|| (ee->request_code == X_CopyArea && ee->error_code == BadDrawable)
+	|| (syncextension && ee->error_code == syncerrbase + XSyncBadCounter)
+	|| (syncextension && ee->error_code == syncerrbase + XSyncBadAlarm))
 		return 0;
 	fprintf(stderr, "dwm: fatal error: request code=%d, error code=%d\n",
 		ee->request_code, ee->error_code);
@@ -2538,6 +4017,12 @@ xerrordummy(Display *dsply, XErrorEvent *ee) {
 	return 0;
 }
 
+int
+xerrorshm(Display *dsply, XErrorEvent *ee) {
+	shmerror = True;
+	return 0;
+}
+
 /* Startup Error handler to check if another window manager
  * is already running. */
 int
@@ -2571,9 +4056,8 @@ main(int argc, char *argv[]) {
 		eprint("usage: dwm [-v]\n");
 	cargv = argv;
 
-	setlocale(LC_CTYPE, "");
-	if(!(dpy = XOpenDisplay(0)))
-		eprint("dwm: cannot open display\n");
+	dc = initdc();
+	dpy = dc->dpy;
 	screen = DefaultScreen(dpy);
 	root = RootWindow(dpy, screen);
 
@@ -2586,7 +4070,7 @@ main(int argc, char *argv[]) {
 	exportstatus();
 	cleanup();
 
-	XCloseDisplay(dpy);
+	freedc(dc);
 	if (reload)
 		doreload();
 	return 0;